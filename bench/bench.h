@@ -0,0 +1,25 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+
+/*
+ * One-off benchmarks run on the device instead of the firmware; see bench/main.cpp
+ */
+
+/**
+ * Compares the firing accuracy of Timer and HiResTimer
+ */
+void bench_timer_accuracy();
+
+/**
+ * Compares the peak heap usage of streaming the sounds as JSON with building a document of all of them
+ */
+void bench_json_export();
+
+/**
+ * Compares the CPU cost of the Q15 output gain with scaling the samples in floating point
+ */
+void bench_gain();
+
+
+#endif //BENCH_H
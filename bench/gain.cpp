@@ -0,0 +1,82 @@
+#include <Arduino.h>
+#include "bench.h"
+#include "util/q15_gain.hpp"
+
+#include <vector>
+
+
+/*
+ * CPU cost of the output gain stage, Q15Gain against scaling the same samples in floating point,
+ * at a constant level and during a fade; measured in cycles per block of one MP3 frame of stereo samples
+ */
+
+namespace
+{
+    constexpr size_t c_frames = 1152;
+    constexpr size_t c_samples = c_frames * 2;
+    constexpr uint32_t c_blocks = 200;
+
+    void fill(std::vector<int16_t>& samples)
+    {
+        for (size_t i = 0; i < samples.size(); ++i)
+            samples[i] = static_cast<int16_t>((i * 7919) & 0xFFFF);
+    }
+
+    template<typename F>
+    uint32_t measure(std::vector<int16_t>& samples, F&& apply)
+    {
+        uint64_t cycles = 0;
+        for (uint32_t block = 0; block < c_blocks; ++block)
+        {
+            fill(samples);
+            auto start = ESP.getCycleCount();
+            apply(samples.data());
+            cycles += ESP.getCycleCount() - start;
+        }
+        return static_cast<uint32_t>(cycles / c_blocks);
+    }
+
+    void print(const char* name, uint32_t cycles)
+    {
+        Serial.printf("%-32s %12lu %12.2f\n", name, cycles, static_cast<double>(cycles) / c_samples);
+    }
+
+    void scale_float(int16_t* samples, float gain)
+    {
+        for (size_t i = 0; i < c_samples; ++i)
+            samples[i] = static_cast<int16_t>(samples[i] * gain);
+    }
+
+    void fade_float(int16_t* samples, float& gain, float step)
+    {
+        for (size_t frame = 0; frame < c_frames; ++frame, gain += step)
+        {
+            samples[2 * frame] = static_cast<int16_t>(samples[2 * frame] * gain);
+            samples[2 * frame + 1] = static_cast<int16_t>(samples[2 * frame + 1] * gain);
+        }
+    }
+}
+
+
+void bench_gain()
+{
+    std::vector<int16_t> samples(c_samples);
+
+    Q15Gain level;
+    level.setFormat(44100, 2);
+    level.setLevel(Q15Gain::fromPercent(50));
+
+    // a fade long enough to last for all blocks
+    Q15Gain fade;
+    fade.setFormat(44100, 2);
+    fade.fade(0, Q15Gain::c_unity, 60000);
+
+    float fade_gain = 0;
+    constexpr float c_fade_step = 1.f / (44100 * 60);
+
+    Serial.printf("%-32s %12s %12s\n", "gain", "cycles", "per sample");
+    print("Q15 level", measure(samples, [&](int16_t* data) { level.apply(data, c_samples); }));
+    print("float level", measure(samples, [](int16_t* data) { scale_float(data, .5f); }));
+    print("Q15 fade", measure(samples, [&](int16_t* data) { fade.apply(data, c_samples); }));
+    print("float fade", measure(samples, [&](int16_t* data) { fade_float(data, fade_gain, c_fade_step); }));
+}
@@ -0,0 +1,66 @@
+#include <Arduino.h>
+#include "bench.h"
+#include "modules/sound_manager.h"
+#include "util/std_container_json.hpp"
+
+#include <esp_heap_caps.h>
+
+
+/*
+ * Peak heap usage of exporting the sounds as JSON, streaming one sound at a time as SoundManager::exportJson() does,
+ * compared to holding the whole collection in a document as done before streaming
+ */
+
+namespace
+{
+    constexpr uint32_t c_sounds = 500;
+
+    // discards the JSON, so only the serialization allocates
+    struct NullPrint final : Print
+    {
+        size_t write(uint8_t) override { return 1; }
+        size_t write(const uint8_t*, size_t size) override { return size; }
+    };
+
+    // measures the lowest free heap while running a function, relative to the free heap before
+    size_t peak(const auto& function)
+    {
+        auto free = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+        heap_caps_monitor_local_minimum_free_size_start();
+        function();
+        auto used = free - heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+        heap_caps_monitor_local_minimum_free_size_stop();
+        return used;
+    }
+}
+
+
+void bench_json_export()
+{
+    SoundTable sounds;
+    for (uint32_t number = 1; number <= c_sounds; ++number)
+    {
+        auto path = "/sounds/sound_" + String(number) + ".mp3";
+        auto name = "Sound " + String(number);
+        sounds.insert(number, path.c_str(), name.c_str(), true, "Title", {180000, 44100, 128, number});
+    }
+
+    size_t size = 0;
+    auto streamed = peak([&]
+    {
+        NullPrint out;
+        size = serializeJsonArray(sounds, out);
+    });
+    auto document = peak([&]
+    {
+        JsonDocument doc;
+        auto array = doc.to<JsonArray>();
+        for (auto sound : sounds)
+            array.add(sound);
+    });
+
+    Serial.printf("%-32s %8s %12s\n", "json export", "sounds", "peak bytes");
+    Serial.printf("%-32s %8lu %12u\n", "streamed", c_sounds, streamed);
+    Serial.printf("%-32s %8lu %12u\n", "document", c_sounds, document);
+    Serial.printf("(%u bytes of JSON)\n", size);
+}
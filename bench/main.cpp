@@ -0,0 +1,25 @@
+#include <Arduino.h>
+#include "bench.h"
+
+
+/*
+ * Runs the benchmarks once after boot instead of the firmware, printing their results to the serial port;
+ * run with: pio run -e bench -t upload -t monitor
+ */
+
+void setup()
+{
+    Serial.begin(SERIAL_BAUD_RATE);
+    // give the monitor time to connect
+    delay(2000);
+
+    bench_timer_accuracy();
+    bench_json_export();
+    bench_gain();
+    Serial.println("benchmarks done");
+}
+
+void loop()
+{
+    vTaskDelete(nullptr);
+}
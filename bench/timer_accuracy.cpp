@@ -0,0 +1,88 @@
+#include <Arduino.h>
+#include "bench.h"
+#include "util/timer.h"
+#include "util/hires_timer.h"
+
+#include <atomic>
+
+
+/*
+ * Firing accuracy of Timer, on the tick-based FreeRTOS timer service, and HiResTimer, on esp_timer;
+ * the lateness of each firing is measured against its schedule, which repeating timers keep without drifting
+ */
+
+namespace
+{
+    constexpr uint32_t c_firings = 10;
+
+    struct Result
+    {
+        uint32_t fired;
+        int64_t max_lateness_us;
+        int64_t total_lateness_us;
+    };
+
+    void print(const char* name, const Result& result)
+    {
+        Serial.printf("%-32s %8lu %12lld %12.1f\n", name, result.fired, result.max_lateness_us,
+                      result.fired ? static_cast<double>(result.total_lateness_us) / result.fired : 0.);
+    }
+
+    Result measure_timer()
+    {
+        Result result{};
+        int64_t due_us = 0;
+        std::atomic<bool> done{false};
+
+        Timer timer{"bench"};
+        timer.always(1, [&]
+        {
+            auto lateness = esp_timer_get_time() - due_us;
+            due_us += 1000000;
+            result.max_lateness_us = _max(result.max_lateness_us, lateness);
+            result.total_lateness_us += lateness;
+            done = ++result.fired == c_firings;
+        });
+        due_us = esp_timer_get_time() + 1000000;
+        timer.start();
+
+        while (!done)
+            delay(100);
+        timer.stop();
+        return result;
+    }
+
+    std::atomic<uint32_t> s_remaining{};
+
+    // runs in the ISR for ISR dispatch, so it only counts down
+    void IRAM_ATTR count_down(void*)
+    {
+        --s_remaining;
+    }
+
+    Result measure_hires(std::chrono::microseconds period, HiResTimer::Dispatch dispatch, uint32_t firings)
+    {
+        HiResTimer timer{"bench", dispatch};
+        s_remaining = firings;
+        if (!timer.always(period, count_down, nullptr, true))
+            return {};
+
+        while (s_remaining > 0)
+            delay(10);
+        timer.stop();
+        auto stats = timer.stats();
+        return {stats.fired, stats.max_lateness_us, stats.total_lateness_us};
+    }
+}
+
+
+void bench_timer_accuracy()
+{
+    using namespace std::chrono_literals;
+
+    Serial.printf("%-32s %8s %12s %12s\n", "timer", "fired", "max late us", "avg late us");
+    print("Timer 1 s", measure_timer());
+    print("HiResTimer 1 s (task)", measure_hires(1s, HiResTimer::Dispatch::task, c_firings));
+    print("HiResTimer 1 ms (task)", measure_hires(1ms, HiResTimer::Dispatch::task, 1000));
+    print("HiResTimer 1 ms (ISR)", measure_hires(1ms, HiResTimer::Dispatch::isr, 1000));
+}
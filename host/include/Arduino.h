@@ -0,0 +1,169 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/*
+ * Minimal host stand-in for the parts of the Arduino core and FreeRTOS used by the code built natively;
+ * time is simulated (see host_sim.h), so delays complete instantly but advance the simulated clock
+ */
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include "host_sim.h"
+
+
+using BaseType_t = int;
+using UBaseType_t = unsigned int;
+using TickType_t = uint32_t;
+using StackType_t = uint8_t;
+using TaskHandle_t = void*;
+using TimerHandle_t = void*;
+using QueueHandle_t = void*;
+using SemaphoreHandle_t = void*;
+using TaskFunction_t = void (*)(void*);
+using TimerCallbackFunction_t = void (*)(TimerHandle_t);
+using PendedFunction_t = void (*)(void*, uint32_t);
+
+//! Timer state, which the modeled timer service accesses until it processed the deletion of the timer
+struct StaticTimer_t
+{
+    void* id;
+    TimerCallbackFunction_t callback;
+    TickType_t period;
+    bool reload;
+    bool active;
+    bool dynamic;
+    int64_t due_us;
+};
+
+struct StaticTask_t { void* handle; };
+struct StaticQueue_t { void* handle; };
+struct StaticSemaphore_t { void* handle; };
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY UINT32_MAX
+#define pdMS_TO_TICKS(ms) static_cast<TickType_t>(ms)
+#define portTICK_PERIOD_MS 1
+#define portYIELD_FROM_ISR() do {} while (0)
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define PRO_CPU_NUM 0
+#define APP_CPU_NUM 1
+
+#define _max(a, b) ((a) > (b) ? (a) : (b))
+#define _abs(x) ((x) > 0 ? (x) : -(x))
+
+//! Spinlock standing in for the FreeRTOS critical section
+struct portMUX_TYPE
+{
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+};
+
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) do { while ((mux)->flag.test_and_set(std::memory_order_acquire)) {} } while (0)
+#define portEXIT_CRITICAL(mux) (mux)->flag.clear(std::memory_order_release)
+
+/*
+ * FreeRTOS model on the simulated clock (see host_sim.h), implemented in freertos.cpp;
+ * tasks and the timer service are threads, and timeouts other than 0 and portMAX_DELAY expire on the simulated clock
+ */
+
+//! Returns a handle unique to the calling thread
+TaskHandle_t xTaskGetCurrentTaskHandle();
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_depth, void* param,
+                                           UBaseType_t priority, StackType_t* stack, StaticTask_t* buffer, BaseType_t core);
+//! Threads can't be killed, so a deleted task keeps blocking in its current wait
+void vTaskDelete(TaskHandle_t task);
+//! Suspending is not modeled, so a suspended task keeps running
+void vTaskSuspend(TaskHandle_t task);
+void vTaskResume(TaskHandle_t task);
+TickType_t xTaskGetTickCount();
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskDelayUntil(TickType_t* previous_wake, TickType_t increment);
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t* storage, StaticQueue_t* buffer);
+//! The queue is leaked, as a deleted task might still be waiting on it
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t timeout);
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* woken);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t timeout);
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer);
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t* buffer);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t timeout);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore);
+
+TimerHandle_t xTimerCreateStatic(const char* name, TickType_t period, UBaseType_t reload, void* id,
+                                 TimerCallbackFunction_t callback, StaticTimer_t* buffer);
+TimerHandle_t xTimerCreate(const char* name, TickType_t period, UBaseType_t reload, void* id,
+                           TimerCallbackFunction_t callback);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t timeout);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t timeout);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t timeout);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t timeout);
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t timeout);
+BaseType_t xTimerPendFunctionCall(PendedFunction_t function, void* param1, uint32_t param2, TickType_t timeout);
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer);
+void vTimerSetReloadMode(TimerHandle_t timer, UBaseType_t reload);
+void* pvTimerGetTimerID(TimerHandle_t timer);
+TaskHandle_t xTimerGetTimerDaemonTaskHandle();
+
+inline unsigned long millis() { return static_cast<unsigned long>(host::now_us() / 1000); }
+inline unsigned long micros() { return static_cast<unsigned long>(host::now_us()); }
+inline void delay(uint32_t ms) { host::advance_us(static_cast<int64_t>(ms) * 1000); }
+
+
+/**
+ * Subset of the Arduino String class backed by a std::string
+ */
+class String
+{
+public:
+    String() = default;
+    String(const char* str) : m_str(str ? str : "") {}
+    String(const char* str, unsigned int length) : m_str(str, length) {}
+    String(const std::string& str) : m_str(str) {}
+    explicit String(char c) : m_str(1, c) {}
+
+    template <typename T> requires std::is_integral_v<T>
+    explicit String(T value) : m_str(std::to_string(value)) {}
+
+    explicit String(double value, unsigned int decimals = 2)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+        m_str = buf;
+    }
+
+    [[nodiscard]] const char* c_str() const { return m_str.c_str(); }
+    [[nodiscard]] unsigned int length() const { return m_str.length(); }
+    [[nodiscard]] bool isEmpty() const { return m_str.empty(); }
+
+    String& operator+=(const String& other)
+    {
+        m_str += other.m_str;
+        return *this;
+    }
+
+    friend String operator+(String lhs, const String& rhs) { return lhs += rhs; }
+    friend String operator+(const char* lhs, const String& rhs) { return String(lhs) += rhs; }
+    bool operator==(const String& other) const = default;
+    bool operator==(const char* other) const { return m_str == other; }
+
+private:
+    std::string m_str{};
+};
+
+
+#endif //HOST_ARDUINO_H
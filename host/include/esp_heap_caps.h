@@ -0,0 +1,17 @@
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+
+#include <cstdlib>
+#include <cstdint>
+
+
+// the host has a single heap, so the capabilities are ignored
+#define MALLOC_CAP_DEFAULT (1 << 12)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline void* heap_caps_realloc(void* ptr, size_t size, uint32_t) { return realloc(ptr, size); }
+inline void heap_caps_free(void* ptr) { free(ptr); }
+
+
+#endif //HOST_ESP_HEAP_CAPS_H
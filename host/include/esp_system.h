@@ -0,0 +1,13 @@
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+#include "esp_err.h"
+
+
+using shutdown_handler_t = void (*)();
+
+//! Registers a handler run by host::shutdown()
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle);
+
+
+#endif //HOST_ESP_SYSTEM_H
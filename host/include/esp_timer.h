@@ -0,0 +1,10 @@
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include "host_sim.h"
+
+
+inline int64_t esp_timer_get_time() { return host::now_us(); }
+
+
+#endif //HOST_ESP_TIMER_H
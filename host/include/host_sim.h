@@ -0,0 +1,71 @@
+#ifndef HOST_SIM_H
+#define HOST_SIM_H
+
+#include <cstdint>
+
+
+/*
+ * Simulation controls of the host build
+ */
+namespace host
+{
+    /**
+     * Modeled NVS flash statistics
+     */
+    struct FlashStats
+    {
+        //! The number of set operations reaching the flash model
+        uint32_t sets = 0;
+        //! The number of set operations skipped as the stored value was identical
+        uint32_t skipped = 0;
+        //! The number of NVS commits, including the one of each Preferences put
+        uint32_t commits = 0;
+        //! The number of 32 byte entries written, including the ones relocated by garbage collection
+        uint32_t entries_written = 0;
+        //! The number of entries relocated by garbage collection
+        uint32_t entries_relocated = 0;
+        //! The number of page erases
+        uint32_t erases = 0;
+        //! The highest erase count of a single page
+        uint32_t max_page_erases = 0;
+        //! The total modeled flash time in µs
+        uint64_t flash_time_us = 0;
+    };
+
+    /**
+     * Get the simulated time since start in µs
+     */
+    int64_t now_us();
+
+    /**
+     * Advances the simulated time, running all timers becoming due in order;
+     * outside of tasks, waits until the timer service and all tasks are idle, e.g., a deferred callback completed
+     * @param us The amount of µs to advance
+     */
+    void advance_us(int64_t us);
+
+    /**
+     * Advances the simulated time without waiting for anything, e.g., to charge the duration of a flash operation
+     * @param us The amount of µs to advance
+     */
+    void charge_us(int64_t us);
+
+    /**
+     * Runs the registered shutdown handlers as a restart would
+     */
+    void shutdown();
+
+    /**
+     * Sets the file backing the modeled NVS partition; must be called before the namespace is opened
+     * @param path The path of the file; an empty path keeps the partition in memory only
+     */
+    void flash_file(const char* path);
+
+    /**
+     * Get the modeled NVS flash statistics
+     */
+    FlashStats flash_stats();
+}
+
+
+#endif //HOST_SIM_H
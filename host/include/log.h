@@ -0,0 +1,30 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <cstdio>
+
+/*
+ * Host replacement of the firmware logging macros printing to stdout;
+ * entries above HOST_LOG_LEVEL (0: errors only, ..., 5: trace) are compiled out
+ */
+
+#ifndef HOST_LOG_LEVEL
+#define HOST_LOG_LEVEL 2
+#endif
+
+#define HOST_LOG(level, tag, format, ...) \
+    do { if (HOST_LOG_LEVEL >= level) printf("[%s] " format "\n", tag __VA_OPT__(,) __VA_ARGS__); } while (0)
+
+#define LOG_F(format, ...) HOST_LOG(0, "F", format __VA_OPT__(,) __VA_ARGS__)
+#define LOG_E(format, ...) HOST_LOG(0, "E", format __VA_OPT__(,) __VA_ARGS__)
+#define LOG_W(format, ...) HOST_LOG(1, "W", format __VA_OPT__(,) __VA_ARGS__)
+#define LOG_N(format, ...) HOST_LOG(1, "N", format __VA_OPT__(,) __VA_ARGS__)
+#define LOG_I(format, ...) HOST_LOG(2, "I", format __VA_OPT__(,) __VA_ARGS__)
+#define LOG_D(format, ...) HOST_LOG(3, "D", format __VA_OPT__(,) __VA_ARGS__)
+#define LOG_T(format, ...) HOST_LOG(4, "T", format __VA_OPT__(,) __VA_ARGS__)
+#define LOG_V(format, ...) HOST_LOG(5, "V", format __VA_OPT__(,) __VA_ARGS__)
+#define LOG_A(format, ...) HOST_LOG(-1, "A", format __VA_OPT__(,) __VA_ARGS__)
+#define LOG(format, ...) LOG_A(format __VA_OPT__(,) __VA_ARGS__)
+
+
+#endif //LOG_H
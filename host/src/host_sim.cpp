@@ -0,0 +1,501 @@
+#include <Arduino.h>
+#include <esp_system.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*
+ * Simulated clock, shutdown handlers and a model of the FreeRTOS tasks, queues, semaphores and timer service
+ *
+ * Tasks and the timer service are threads synchronized by a single mutex; the timer service fires timers
+ * once the simulated clock reached them, which host::advance_us() moves forward.
+ * A task blocked in a wait registers its condition, so host::advance_us() can wait until the model is idle
+ */
+
+namespace
+{
+    struct Queue
+    {
+        size_t item_size;
+        size_t capacity;
+        std::deque<std::vector<uint8_t>> items{};
+    };
+
+    struct Semaphore
+    {
+        bool recursive;
+        TaskHandle_t owner = nullptr;
+        uint32_t count = 0;
+    };
+
+    struct Command
+    {
+        enum Type : uint8_t { start, stop, change_period, remove, pend };
+
+        Type type;
+        StaticTimer_t* timer = nullptr;
+        TickType_t period = 0;
+        PendedFunction_t function = nullptr;
+        void* param1 = nullptr;
+        uint32_t param2 = 0;
+    };
+
+    // the default length of the ESP-IDF timer command queue
+    constexpr size_t c_timer_queue_length = 10;
+
+    // leaked, as objects with static storage duration might use the model after this translation unit was destroyed
+    auto& s_mutex = *new std::mutex{};
+    auto& s_changed = *new std::condition_variable{};
+    auto& s_blocked = *new std::vector<const std::function<bool()>*>{};
+    auto& s_queues = *new std::vector<Queue*>{};
+    auto& s_timers = *new std::vector<StaticTimer_t*>{};
+    auto& s_commands = *new std::deque<Command>{};
+    std::vector<shutdown_handler_t> s_shutdown_handlers{};
+
+    std::atomic<int64_t> s_now_us{0};
+    // timers due until this time are fired, even if no task charged the time yet
+    int64_t s_target_us = 0;
+    // the tasks not blocked in a wait of the model
+    uint32_t s_running = 0;
+    thread_local TaskHandle_t t_task = nullptr;
+
+    int64_t to_us(TickType_t ticks) { return static_cast<int64_t>(ticks) * portTICK_PERIOD_MS * 1000; }
+
+    /**
+     * Waits for a condition, which must only depend on state guarded by s_mutex
+     * @return Whether the condition is met, i.e., the wait did not time out
+     */
+    bool wait(std::unique_lock<std::mutex>& lock, TickType_t timeout, const std::function<bool()>& ready)
+    {
+        if (ready())
+            return true;
+        if (timeout == 0)
+            return false;
+
+        auto deadline = timeout == portMAX_DELAY ? INT64_MAX : s_now_us + to_us(timeout);
+        const std::function<bool()> woken = [&] { return ready() || s_now_us >= deadline; };
+        if (t_task)
+        {
+            --s_running;
+            s_blocked.push_back(&woken);
+            s_changed.notify_all();
+        }
+        s_changed.wait(lock, woken);
+        if (t_task)
+        {
+            ++s_running;
+            std::erase(s_blocked, &woken);
+        }
+        return ready();
+    }
+
+    bool idle()
+    {
+        return s_running == 0 && std::ranges::none_of(s_blocked, [](auto* woken) { return (*woken)(); });
+    }
+
+    StaticTimer_t* due_timer()
+    {
+        auto until = std::max(s_target_us, s_now_us.load());
+        StaticTimer_t* due = nullptr;
+        for (auto* timer : s_timers)
+        {
+            if (timer->active && timer->due_us <= until && (!due || timer->due_us < due->due_us))
+                due = timer;
+        }
+        return due;
+    }
+
+    void run_timer_service(void*)
+    {
+        std::unique_lock lock(s_mutex);
+        while (true)
+        {
+            wait(lock, portMAX_DELAY, [] { return !s_commands.empty() || due_timer(); });
+
+            if (!s_commands.empty())
+            {
+                auto command = s_commands.front();
+                s_commands.pop_front();
+                s_changed.notify_all();
+
+                auto* timer = command.timer;
+                switch (command.type)
+                {
+                case Command::change_period:
+                    timer->period = command.period;
+                    [[fallthrough]];
+                case Command::start:
+                    timer->active = true;
+                    timer->due_us = s_now_us + to_us(timer->period);
+                    break;
+                case Command::stop:
+                    timer->active = false;
+                    break;
+                case Command::remove:
+                    std::erase(s_timers, timer);
+                    if (timer->dynamic)
+                        delete timer;
+                    break;
+                case Command::pend:
+                    lock.unlock();
+                    command.function(command.param1, command.param2);
+                    lock.lock();
+                    break;
+                }
+                continue;
+            }
+
+            auto* timer = due_timer();
+            s_now_us = std::max(s_now_us.load(), timer->due_us);
+            if (timer->reload)
+                timer->due_us += to_us(timer->period);
+            else
+                timer->active = false;
+
+            lock.unlock();
+            timer->callback(timer);
+            lock.lock();
+        }
+    }
+
+    TaskHandle_t timer_service()
+    {
+        // started on first use, like the scheduler starting it on the device
+        static StaticTask_t buffer{};
+        static TaskHandle_t task = xTaskCreateStaticPinnedToCore(run_timer_service, "Tmr Svc", 0, nullptr, 1,
+                                                                 nullptr, &buffer, tskNO_AFFINITY);
+        return task;
+    }
+
+    BaseType_t send(const Command& command, TickType_t timeout)
+    {
+        auto service = timer_service();
+        std::unique_lock lock(s_mutex);
+        if (timeout != 0 && t_task == service && s_commands.size() >= c_timer_queue_length)
+        {
+            // the timer service would wait for itself forever on the device
+            fprintf(stderr, "timer service blocked on its own command queue\n");
+            abort();
+        }
+        if (!wait(lock, timeout, [] { return s_commands.size() < c_timer_queue_length; }))
+            return pdFAIL;
+        s_commands.push_back(command);
+        s_changed.notify_all();
+        return pdPASS;
+    }
+
+    TimerHandle_t create_timer(StaticTimer_t& buffer, TickType_t period, UBaseType_t reload, void* id,
+                               TimerCallbackFunction_t callback, bool dynamic)
+    {
+        // like configASSERT() on the device
+        if (period == 0)
+            return nullptr;
+        std::lock_guard lock(s_mutex);
+        buffer = {id, callback, period, reload != pdFALSE, false, dynamic, 0};
+        s_timers.push_back(&buffer);
+        return &buffer;
+    }
+
+    StaticTimer_t* timer(TimerHandle_t handle) { return static_cast<StaticTimer_t*>(handle); }
+    Queue* queue(QueueHandle_t handle) { return static_cast<Queue*>(handle); }
+    Semaphore* semaphore(SemaphoreHandle_t handle) { return static_cast<Semaphore*>(handle); }
+}
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    static thread_local char handle;
+    return t_task ? t_task : &handle;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t function, const char*, uint32_t, void* param, UBaseType_t,
+                                           StackType_t*, StaticTask_t* buffer, BaseType_t)
+{
+    {
+        // counted as running before the thread starts, so the model isn't considered idle in between
+        std::lock_guard lock(s_mutex);
+        ++s_running;
+    }
+    buffer->handle = buffer;
+    std::thread([=]
+    {
+        t_task = buffer;
+        function(param);
+        std::lock_guard lock(s_mutex);
+        --s_running;
+        s_changed.notify_all();
+    }).detach();
+    return buffer;
+}
+
+void vTaskDelete(TaskHandle_t)
+{
+}
+
+void vTaskSuspend(TaskHandle_t)
+{
+}
+
+void vTaskResume(TaskHandle_t)
+{
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return static_cast<TickType_t>(host::now_us() / (portTICK_PERIOD_MS * 1000));
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (!t_task)
+    {
+        host::advance_us(to_us(ticks));
+        return;
+    }
+    std::unique_lock lock(s_mutex);
+    wait(lock, ticks, [] { return false; });
+}
+
+
+BaseType_t xTaskDelayUntil(TickType_t* previous_wake, TickType_t increment)
+{
+    auto wake = *previous_wake + increment;
+    auto now = xTaskGetTickCount();
+    *previous_wake = wake;
+    if (static_cast<int32_t>(wake - now) <= 0)
+        return pdFALSE;
+    vTaskDelay(wake - now);
+    return pdTRUE;
+}
+
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t*, StaticQueue_t* buffer)
+{
+    std::lock_guard lock(s_mutex);
+    buffer->handle = s_queues.emplace_back(new Queue{item_size, length});
+    return buffer->handle;
+}
+
+void vQueueDelete(QueueHandle_t)
+{
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void* item, TickType_t timeout)
+{
+    auto* q = queue(handle);
+    std::unique_lock lock(s_mutex);
+    if (!wait(lock, timeout, [q] { return q->items.size() < q->capacity; }))
+        return pdFAIL;
+    auto* bytes = static_cast<const uint8_t*>(item);
+    q->items.emplace_back(bytes, bytes + q->item_size);
+    s_changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t handle, const void* item, BaseType_t* woken)
+{
+    *woken = pdFALSE;
+    return xQueueSend(handle, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void* item, TickType_t timeout)
+{
+    auto* q = queue(handle);
+    std::unique_lock lock(s_mutex);
+    if (!wait(lock, timeout, [q] { return !q->items.empty(); }))
+        return pdFAIL;
+    memcpy(item, q->items.front().data(), q->item_size);
+    q->items.pop_front();
+    s_changed.notify_all();
+    return pdPASS;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer)
+{
+    return buffer->handle = new Semaphore{false};
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t* buffer)
+{
+    return buffer->handle = new Semaphore{true};
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t handle)
+{
+    delete semaphore(handle);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t timeout)
+{
+    auto* sem = semaphore(handle);
+    std::unique_lock lock(s_mutex);
+    if (!wait(lock, timeout, [sem] { return sem->count > 0; }))
+        return pdFAIL;
+    --sem->count;
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle)
+{
+    auto* sem = semaphore(handle);
+    std::lock_guard lock(s_mutex);
+    if (sem->count > 0)
+        return pdFAIL;
+    ++sem->count;
+    s_changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t handle, TickType_t timeout)
+{
+    auto* sem = semaphore(handle);
+    auto self = xTaskGetCurrentTaskHandle();
+    std::unique_lock lock(s_mutex);
+    if (!wait(lock, timeout, [sem, self] { return !sem->owner || sem->owner == self; }))
+        return pdFAIL;
+    sem->owner = self;
+    ++sem->count;
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t handle)
+{
+    auto* sem = semaphore(handle);
+    std::lock_guard lock(s_mutex);
+    if (sem->owner != xTaskGetCurrentTaskHandle())
+        return pdFAIL;
+    if (--sem->count == 0)
+    {
+        sem->owner = nullptr;
+        s_changed.notify_all();
+    }
+    return pdPASS;
+}
+
+
+TimerHandle_t xTimerCreateStatic(const char*, TickType_t period, UBaseType_t reload, void* id,
+                                 TimerCallbackFunction_t callback, StaticTimer_t* buffer)
+{
+    return create_timer(*buffer, period, reload, id, callback, false);
+}
+
+TimerHandle_t xTimerCreate(const char*, TickType_t period, UBaseType_t reload, void* id,
+                           TimerCallbackFunction_t callback)
+{
+    auto* buffer = new StaticTimer_t{};
+    auto* handle = create_timer(*buffer, period, reload, id, callback, true);
+    if (!handle)
+        delete buffer;
+    return handle;
+}
+
+BaseType_t xTimerStart(TimerHandle_t handle, TickType_t timeout)
+{
+    return send({Command::start, timer(handle)}, timeout);
+}
+
+BaseType_t xTimerStop(TimerHandle_t handle, TickType_t timeout)
+{
+    return send({Command::stop, timer(handle)}, timeout);
+}
+
+BaseType_t xTimerReset(TimerHandle_t handle, TickType_t timeout)
+{
+    return send({Command::start, timer(handle)}, timeout);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t handle, TickType_t period, TickType_t timeout)
+{
+    if (period == 0)
+        return pdFAIL;
+    return send({Command::change_period, timer(handle), period}, timeout);
+}
+
+BaseType_t xTimerDelete(TimerHandle_t handle, TickType_t timeout)
+{
+    return send({Command::remove, timer(handle)}, timeout);
+}
+
+BaseType_t xTimerPendFunctionCall(PendedFunction_t function, void* param1, uint32_t param2, TickType_t timeout)
+{
+    return send({.type = Command::pend, .function = function, .param1 = param1, .param2 = param2}, timeout);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t handle)
+{
+    std::lock_guard lock(s_mutex);
+    return timer(handle)->active;
+}
+
+void vTimerSetReloadMode(TimerHandle_t handle, UBaseType_t reload)
+{
+    std::lock_guard lock(s_mutex);
+    timer(handle)->reload = reload != pdFALSE;
+}
+
+void* pvTimerGetTimerID(TimerHandle_t handle)
+{
+    return timer(handle)->id;
+}
+
+TaskHandle_t xTimerGetTimerDaemonTaskHandle()
+{
+    return timer_service();
+}
+
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle)
+{
+    s_shutdown_handlers.push_back(handle);
+    return ESP_OK;
+}
+
+
+int64_t host::now_us()
+{
+    return s_now_us.load(std::memory_order_relaxed);
+}
+
+void host::charge_us(int64_t us)
+{
+    std::lock_guard lock(s_mutex);
+    s_now_us += us;
+    s_changed.notify_all();
+}
+
+void host::advance_us(int64_t us)
+{
+    // a task can't wait for the model to become idle, as it is part of it
+    if (t_task)
+    {
+        charge_us(us);
+        return;
+    }
+
+    std::unique_lock lock(s_mutex);
+    s_target_us = std::max(s_target_us, s_now_us + us);
+    s_changed.notify_all();
+    while (true)
+    {
+        s_changed.wait(lock, idle);
+        if (s_now_us >= s_target_us)
+            break;
+        // all timers until the target ran, so moving the clock can only wake tasks delayed until then
+        s_now_us = s_target_us;
+        s_changed.notify_all();
+    }
+}
+
+void host::shutdown()
+{
+    for (auto handler : s_shutdown_handlers)
+        handler();
+}
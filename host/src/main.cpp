@@ -0,0 +1,513 @@
+#include <Arduino.h>
+#include <host_sim.h>
+#include "util/nvs.hpp"
+#include "modules/sound_table.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+
+/*
+ * Native simulation of the NVS usage patterns of the firmware, reporting the resulting commits
+ * and the modeled flash time and wear, followed by stress tests of the utilities;
+ * pass a file path to keep the modeled partition across runs
+ */
+
+// flash sectors are specified for at least 100k erase cycles
+static constexpr uint32_t c_erase_endurance = 100000;
+// pages of the modeled partition
+#define HOST_SIM_PAGE_COUNT 5
+
+struct AlarmData
+{
+    static constexpr uint16_t nvs_version = 2;
+
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t repeat;
+    uint32_t sound;
+    bool enabled;
+
+    bool operator==(const AlarmData&) const = default;
+};
+
+// the same keys and defaults as the firmware
+static NVV<uint8_t> volume{"volume", 50};
+static NVV<uint8_t> light_duration{"light_duration", 45};
+static NVV<String> time_zone{"timezone", "UTC"};
+static NVV<AlarmData> alarm1{"alarm1"};
+static NVV<AlarmData> alarm2{"alarm2"};
+static NVV<AlarmData>::Field<uint8_t> alarm1_hour{alarm1, &AlarmData::hour};
+
+
+/**
+ * Runs a usage pattern and prints the NVS and flash statistics it caused
+ * @param name The name of the pattern
+ * @param pattern The function performing the pattern
+ */
+static void measure(const char* name, const auto& pattern)
+{
+    auto nvs_before = NVS::stats();
+    auto flash_before = host::flash_stats();
+    auto start = host::now_us();
+
+    pattern();
+    // let the delayed commit run
+    delay((NVS_COMMIT_DELAY + 1) * 1000);
+
+    auto nvs = NVS::stats();
+    auto flash = host::flash_stats();
+    printf("%-24s %8u %8u %8u %8u %8u %8u %10.1f %10.1f\n", name,
+           nvs.changes - nvs_before.changes,
+           nvs.commits - nvs_before.commits,
+           nvs.writes - nvs_before.writes,
+           flash.entries_written - flash_before.entries_written,
+           flash.entries_relocated - flash_before.entries_relocated,
+           flash.erases - flash_before.erases,
+           static_cast<double>(flash.flash_time_us - flash_before.flash_time_us) / 1000.,
+           static_cast<double>(host::now_us() - start) / 1000.);
+}
+
+/**
+ * Scrolls the alarm hour in the UI to the given hour, one step every 150 ms
+ * @param to The hour to stop at
+ * @param write_through Whether to commit each step immediately, as done before batching the commits
+ */
+static void scroll_alarm_hour(uint8_t to, bool write_through = false)
+{
+    while (*alarm1_hour != to)
+    {
+        alarm1_hour = (*alarm1_hour + 1) % 24;
+        if (write_through)
+            NVS::commit();
+        delay(150);
+    }
+}
+
+/**
+ * Scrolls the alarm hour a thousand times to changing hours with a pause of 5 s in between
+ * @param write_through Whether to commit each step immediately
+ */
+static void scroll_alarm_hour_x1000(bool write_through)
+{
+    for (int i = 0; i < 1000; ++i)
+    {
+        scroll_alarm_hour((*alarm1_hour + 1 + i % 12) % 24, write_through);
+        delay(5000);
+    }
+}
+
+// dragging the volume slider of the web UI, one request every 20 ms
+static void drag_volume()
+{
+    for (uint8_t vol = 0; vol <= 100; ++vol)
+    {
+        volume = vol;
+        delay(20);
+    }
+}
+
+// setting the whole alarm at once from the web UI
+static void edit_alarm()
+{
+    NVS::Transaction transaction;
+    auto data = alarm2.read();
+    data.hour = (data.hour + 1) % 24;
+    data.minute = 30;
+    data.repeat = 1 << 4;
+    data.enabled = true;
+    alarm2 = data;
+}
+
+/**
+ * Reads values from other threads while they are written, counting reads of partially written values
+ * @return The number of torn reads
+ */
+static uint32_t concurrent_reads()
+{
+    std::atomic<bool> done{false};
+    std::atomic<uint32_t> torn{0};
+
+    // the readers expect all alarm members and all timezone characters to be equal
+    alarm1 = {0, 0, 0, 0, true};
+    time_zone = "A";
+
+    auto reader = [&]
+    {
+        while (!done)
+        {
+            auto data = alarm1.read();
+            if (data.minute != data.hour || data.repeat != data.hour || data.sound != data.hour)
+                ++torn;
+            // the dereference operator reads the same snapshot
+            for (const auto& tz : {time_zone.read(), *time_zone})
+            {
+                const char first_char[] = {tz.c_str()[0], '\0'};
+                if (strspn(tz.c_str(), first_char) != tz.length())
+                    ++torn;
+            }
+        }
+    };
+    std::thread first(reader);
+    std::thread second(reader);
+
+    for (uint32_t i = 0; i < 20000; ++i)
+    {
+        auto value = static_cast<uint8_t>(i);
+        alarm1 = {value, value, value, value, true};
+        time_zone = String(std::string(1 + i % 40, static_cast<char>('A' + i % 26)));
+    }
+
+    done = true;
+    first.join();
+    second.join();
+    return torn;
+}
+
+/**
+ * Changes a value while another thread holds a transaction, which must neither block
+ * nor notify the value's observers before the transaction ends
+ * @return The number of failed checks
+ */
+static uint32_t transaction_writes()
+{
+    static std::atomic<uint32_t> notified{0};
+    std::atomic<bool> in_transaction{false};
+    std::atomic<bool> release{false};
+    std::atomic<bool> written{false};
+    uint32_t failures = 0;
+
+    light_duration.observe([](auto) { ++notified; });
+    std::thread owner([&]
+    {
+        NVS::Transaction transaction;
+        alarm1_hour = 7;
+        in_transaction = true;
+        while (!release)
+            std::this_thread::yield();
+    });
+    while (!in_transaction)
+        std::this_thread::yield();
+
+    std::thread writer([&]
+    {
+        light_duration = light_duration.read() + 1;
+        written = true;
+    });
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!written && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+    failures += !written;
+    failures += notified != 0;
+
+    release = true;
+    owner.join();
+    writer.join();
+    failures += notified != 1;
+    return failures;
+}
+
+/**
+ * Inserts sounds in a scrambled order, growing the rows and the arena,
+ * and checks the returned positions and the order of the rows
+ * @return The number of wrong positions and rows out of order
+ */
+static uint32_t sound_table_check()
+{
+    constexpr uint32_t c_sounds = 1000;
+
+    uint32_t failures = 0;
+    SoundTable table;
+    for (uint32_t i = 0; i < c_sounds; ++i)
+    {
+        // 7919 is coprime to the count, so every number is inserted once
+        auto number = 1 + i * 7919 % c_sounds;
+        auto path = "/sounds/" + std::to_string(number) + ".mp3";
+        auto row = table.insert(number, path.c_str(), "name", true);
+        if (row == SoundTable::npos || row != table.find(number) || table.path(row) != path)
+            ++failures;
+    }
+    for (size_t row = 1; row < table.size(); ++row)
+    {
+        if (table.number(row - 1) >= table.number(row))
+            ++failures;
+    }
+    return failures + (table.size() == c_sounds ? 0 : 1);
+}
+
+/**
+ * Stores strings from several threads into a read-copy-update cell while further threads read them,
+ * so a copy freed while still being read is caught by the address sanitizer
+ * @return The number of reads returning a partially written string
+ */
+static uint32_t rcu_stress()
+{
+    constexpr uint32_t c_readers = 4;
+    constexpr uint32_t c_writers = 2;
+
+    RcuCell<String> cell{"A"};
+    std::atomic<bool> done{false};
+    std::atomic<uint32_t> torn{0};
+
+    auto uniform = [](const String& value)
+    {
+        const char first_char[] = {value.c_str()[0], '\0'};
+        return strspn(value.c_str(), first_char) == value.length();
+    };
+
+    std::vector<std::thread> readers;
+    for (uint32_t t = 0; t < c_readers; ++t)
+    {
+        readers.emplace_back([&]
+        {
+            while (!done)
+            {
+                // a held copy must stay valid while further stores replace it
+                auto held = cell.get();
+                if (!uniform(cell.load()) || !uniform(*held))
+                    ++torn;
+            }
+        });
+    }
+
+    std::vector<std::thread> writers;
+    for (uint32_t t = 0; t < c_writers; ++t)
+    {
+        writers.emplace_back([&, t]
+        {
+            for (uint32_t i = 0; i < 20000; ++i)
+                cell.store(String(std::string(1 + (i + t) % 64, static_cast<char>('A' + (i + t) % 26))));
+        });
+    }
+    for (auto& writer : writers)
+        writer.join();
+    done = true;
+    for (auto& reader : readers)
+        reader.join();
+    return torn;
+}
+
+/**
+ * Fires thousands of detached and owned timers, re-creating and destroying owned timers from their own callbacks
+ * and from other threads while they fire, both on the timer service and deferred to the worker task
+ * @return The number of detached executions lost plus the owned executions after their timer was destroyed
+ */
+static uint32_t timer_stress()
+{
+    constexpr uint32_t c_threads = 4;
+    constexpr uint32_t c_detached = 2000;
+    constexpr uint32_t c_owned = 600;
+
+    std::atomic<uint32_t> detached_executed{0};
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < c_threads; ++t)
+    {
+        threads.emplace_back([&, t]
+        {
+            for (uint32_t i = 0; i < c_detached / c_threads; ++i)
+            {
+                // the timer service queue is short, so creating fails while it is full
+                while (!Timer::detached(1 + (i + t) % 5, [&] { ++detached_executed; }))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    threads.clear();
+
+    struct Owned
+    {
+        std::unique_ptr<Timer> timer = std::make_unique<Timer>("stress");
+        std::atomic<bool> destroyed{false};
+    };
+    std::vector<Owned> owned(c_owned);
+    auto skipped = Timer::skipped();
+    std::atomic<uint32_t> executions{0};
+    std::atomic<uint32_t> late{0};
+    for (uint32_t i = 0; i < c_owned; ++i)
+    {
+        auto& entry = owned[i];
+        // some timers run on the worker task, where they might still be queued when destroyed;
+        // the worker queue is short, so the more timers firing at once are deferred, the more executions are skipped
+        entry.timer->setDeferred(i % 16 < 2);
+        switch (i % 3)
+        {
+        case 0:
+            // destroyed by another thread while firing
+            entry.timer->always(1 + i % 4, [&] { entry.destroyed ? ++late : ++executions; }, true);
+            break;
+        case 1:
+            // destroys itself inside its callback
+            entry.timer->always(1 + i % 4, [&]
+            {
+                entry.destroyed ? ++late : ++executions;
+                entry.timer.reset();
+                entry.destroyed = true;
+            }, true);
+            break;
+        default:
+            // re-creates itself inside its callback, then is destroyed by another thread
+            entry.timer->once(1 + i % 4, [&]
+            {
+                entry.destroyed ? ++late : ++executions;
+                entry.timer->always(1, [&] { entry.destroyed ? ++late : ++executions; }, true);
+            }, true);
+            break;
+        }
+    }
+
+    // the timers are destroyed spread over 5 s, while they fire
+    auto start = host::now_us();
+    for (uint32_t t = 0; t < c_threads; ++t)
+    {
+        threads.emplace_back([&, t]
+        {
+            for (uint32_t i = t; i < c_owned; i += c_threads)
+            {
+                if (i % 3 == 1)
+                    continue;
+                while (host::now_us() < start + static_cast<int64_t>(i) * 5000000 / c_owned)
+                    std::this_thread::yield();
+                owned[i].timer.reset();
+                owned[i].destroyed = true;
+            }
+        });
+    }
+    for (int step = 0; step < 50; ++step)
+        delay(100);
+    for (auto& thread : threads)
+        thread.join();
+    delay(10000);
+    skipped = Timer::skipped() - skipped;
+
+    // a deferred timer destroyed while queued behind an execution blocking the worker task
+    StaticSemaphore_t gate_buffer;
+    auto gate = xSemaphoreCreateBinaryStatic(&gate_buffer);
+    Timer blocking("blocking");
+    blocking.setDeferred(true);
+    blocking.once(1, [&] { xSemaphoreTake(gate, portMAX_DELAY); }, true);
+    auto queued = std::make_unique<Timer>("queued");
+    queued->setDeferred(true);
+    queued->once(1, [&] { ++late; }, true);
+    delay(1000);
+    queued.reset();
+    delay(0);
+    xSemaphoreGive(gate);
+    delay(0);
+    vSemaphoreDelete(gate);
+
+    printf("timer stress: %u of %u detached timers executed; %u owned executions, %u after destruction, "
+           "%u deferred executions skipped\n", detached_executed.load(), c_detached, executions.load(), late.load(),
+           skipped);
+    // the deferred timers firing at once overflow the worker queue, which must be counted
+    return c_detached - detached_executed + late + (skipped == 0);
+}
+
+
+int main(int argc, char** argv)
+{
+    host::flash_file(argc > 1 ? argv[1] : nullptr);
+
+    // the first boot finds the entries a former firmware stored the second alarm in
+    Preferences prefs{};
+    prefs.begin("alarm_clock", false);
+    auto legacy = !prefs.isKey("alarm2");
+    if (legacy)
+    {
+        prefs.putUChar("a2hour", 6);
+        prefs.putUChar("a2minute", 30);
+        prefs.putUChar("a2repeat", 0b0111110);
+        prefs.putUChar("a2sound", 1);
+        prefs.putBool("a2enabled", true);
+    }
+    alarm2.migrateFrom([](AlarmData& data)
+    {
+        bool found = false;
+        auto take = [&](const char* key, auto& member)
+        {
+            if (auto value = NVS::takeLegacy(key))
+            {
+                member = *value;
+                found = true;
+            }
+        };
+        take("a2hour", data.hour);
+        take("a2minute", data.minute);
+        take("a2repeat", data.repeat);
+        take("a2sound", data.sound);
+        take("a2enabled", data.enabled);
+        return found;
+    });
+
+    auto commits = host::flash_stats().commits;
+    auto boot = host::now_us();
+    NVS::begin("alarm_clock");
+    printf("boot: %.1f ms (modeled), %u NVS commits\n", static_cast<double>(host::now_us() - boot) / 1000.,
+           host::flash_stats().commits - commits);
+    if (legacy)
+    {
+        printf("  -> migrated alarm2: %s, former entries left: %s\n",
+               alarm2.read() == AlarmData{6, 30, 0b0111110, 1, true} ? "yes" : "no",
+               prefs.isKey("a2hour") || prefs.isKey("a2enabled") ? "yes" : "no");
+    }
+    printf("\n");
+
+    printf("%-24s %8s %8s %8s %8s %8s %8s %10s %10s\n",
+           "pattern", "changes", "commits", "writes", "entries", "moved", "erases", "flash ms", "total ms");
+    measure("scroll alarm hour", [] { scroll_alarm_hour((*alarm1_hour + 23) % 24); });
+    measure("drag volume slider", drag_volume);
+    measure("edit alarm", edit_alarm);
+    measure("light duration", [] { light_duration = *light_duration == 45 ? 60 : 45; });
+
+    // provisioning: restore a previously exported configuration in a single request
+    auto snapshot = NVS::exportSnapshot();
+    auto expected = std::tuple(volume.read(), time_zone.read(), alarm2.read());
+    volume = 10;
+    time_zone = "CET-1CEST,M3.5.0,M10.5.0/3";
+    alarm2 = {7, 15, 0b0111110, 2, true};
+    delay((NVS_COMMIT_DELAY + 1) * 1000);
+    measure("import snapshot", [&] { NVS::importSnapshot(snapshot.data(), snapshot.size()); });
+    printf("  -> %zu byte snapshot, restored: %s\n", snapshot.size(),
+           expected == std::tuple(volume.read(), time_zone.read(), alarm2.read()) ? "yes" : "no");
+
+
+    printf("\n");
+    for (auto write_through : {false, true})
+    {
+        auto before = host::flash_stats();
+        measure(write_through ? "scroll x1000 (direct)" : "scroll x1000", [=] { scroll_alarm_hour_x1000(write_through); });
+        if (auto erases = host::flash_stats().erases - before.erases)
+        {
+            // garbage collection rotates through the pages, so the erases spread evenly
+            auto scrolls = static_cast<uint64_t>(c_erase_endurance) * HOST_SIM_PAGE_COUNT * 1000 / erases;
+            printf("  -> pages reach %" PRIu32 " erase cycles after ~%" PRIu64 " scrolls\n", c_erase_endurance, scrolls);
+        }
+        else
+        {
+            printf("  -> no page erased\n");
+        }
+    }
+
+    auto flash = host::flash_stats();
+    printf("\nmodeled wear: %u page erases in total, most erased page %u times\n",
+           flash.erases, flash.max_page_erases);
+
+    auto torn = concurrent_reads();
+    host::shutdown();
+    printf("concurrent reads: %u torn values\n", torn);
+    auto tx_failures = transaction_writes();
+    printf("transaction writes: %u failures\n", tx_failures);
+    auto rcu_torn = rcu_stress();
+    printf("rcu stress: %u torn values\n", rcu_torn);
+
+    auto table_failures = sound_table_check();
+    printf("sound table: %u failures\n", table_failures);
+
+    auto timer_failures = timer_stress();
+    return torn == 0 && tx_failures == 0 && rcu_torn == 0 && table_failures == 0 && timer_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,625 @@
+#include <Preferences.h>
+#include <host_sim.h>
+#include "log.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// page layout of the default NVS partition (0x5000 bytes, see partitions.csv)
+#ifndef HOST_NVS_PAGE_COUNT
+#define HOST_NVS_PAGE_COUNT 5
+#endif
+
+#ifndef HOST_NVS_ENTRIES_PER_PAGE
+#define HOST_NVS_ENTRIES_PER_PAGE 126
+#endif
+
+#ifndef HOST_NVS_ENTRY_SIZE
+#define HOST_NVS_ENTRY_SIZE 32
+#endif
+
+// modeled latencies: looking up and verifying an item, programming a single entry, erasing a 4 KiB sector
+#ifndef HOST_NVS_SET_US
+#define HOST_NVS_SET_US 250
+#endif
+
+#ifndef HOST_NVS_ENTRY_WRITE_US
+#define HOST_NVS_ENTRY_WRITE_US 40
+#endif
+
+#ifndef HOST_NVS_PAGE_ERASE_US
+#define HOST_NVS_PAGE_ERASE_US 45000
+#endif
+
+
+/*
+ * Model of the NVS partition: each item occupies one or more 32 byte entries on a page;
+ * updating an item appends a new copy and marks the old entries as erased.
+ * If the active page is full, the next free page is used, keeping one page in reserve for garbage collection,
+ * which relocates the live entries of the page with the most erased entries into the reserve and erases it
+ */
+namespace
+{
+    struct Page
+    {
+        uint32_t used = 0;
+        uint32_t erased = 0;
+        uint32_t erase_count = 0;
+    };
+
+    struct Item
+    {
+        nvs_type_t type;
+        std::vector<uint8_t> data;
+        size_t page;
+        uint32_t span;
+    };
+
+    class Flash
+    {
+    public:
+        void open(const std::string& path)
+        {
+            std::lock_guard lock(m_mutex);
+            m_path = path;
+            load();
+        }
+
+        const Item* find(const std::string& ns, const std::string& key)
+        {
+            std::lock_guard lock(m_mutex);
+            auto it = m_items.find(ns + '/' + key);
+            return it == m_items.end() ? nullptr : &it->second;
+        }
+
+        bool set(const std::string& ns, const std::string& key, nvs_type_t type, const void* data, size_t len)
+        {
+            std::lock_guard lock(m_mutex);
+            ++m_stats.sets;
+            m_stats.flash_time_us += HOST_NVS_SET_US;
+            charge(HOST_NVS_SET_US);
+
+            const auto* bytes = static_cast<const uint8_t*>(data);
+            auto name = ns + '/' + key;
+            auto it = m_items.find(name);
+            // like the NVS library, identical values are not written again
+            if (it != m_items.end() && it->second.type == type &&
+                std::ranges::equal(it->second.data, std::span(bytes, len)))
+            {
+                ++m_stats.skipped;
+                return true;
+            }
+
+            auto span = entry_span(type, len);
+            auto page = allocate(span);
+            if (page < 0)
+                return false;
+            written(span);
+
+            if (it != m_items.end())
+                m_pages[it->second.page].erased += it->second.span;
+            m_items[name] = {type, {bytes, bytes + len}, static_cast<size_t>(page), span};
+            save();
+            return true;
+        }
+
+        bool remove(const std::string& name)
+        {
+            std::lock_guard lock(m_mutex);
+            auto it = m_items.find(name);
+            if (it == m_items.end())
+                return false;
+            // erasing entries only updates the page's entry state bitmap
+            m_stats.flash_time_us += HOST_NVS_ENTRY_WRITE_US;
+            charge(HOST_NVS_ENTRY_WRITE_US);
+            m_pages[it->second.page].erased += it->second.span;
+            m_items.erase(it);
+            save();
+            return true;
+        }
+
+        std::vector<std::string> keys(const std::string& ns)
+        {
+            std::lock_guard lock(m_mutex);
+            std::vector<std::string> keys{};
+            auto prefix = ns + '/';
+            for (auto it = m_items.lower_bound(prefix); it != m_items.end() && it->first.starts_with(prefix); ++it)
+                keys.push_back(it->first.substr(prefix.size()));
+            return keys;
+        }
+
+        void commit()
+        {
+            std::lock_guard lock(m_mutex);
+            ++m_stats.commits;
+        }
+
+        size_t freeEntries()
+        {
+            std::lock_guard lock(m_mutex);
+            size_t free = 0;
+            for (size_t i = 0; i < m_pages.size(); ++i)
+            {
+                if (i != reserve())
+                    free += HOST_NVS_ENTRIES_PER_PAGE - m_pages[i].used + m_pages[i].erased;
+            }
+            return free;
+        }
+
+        host::FlashStats stats()
+        {
+            std::lock_guard lock(m_mutex);
+            auto stats = m_stats;
+            for (const auto& page : m_pages)
+                stats.max_page_erases = std::max(stats.max_page_erases, page.erase_count);
+            return stats;
+        }
+
+    private:
+        std::recursive_mutex m_mutex{};
+        std::string m_path{};
+        std::array<Page, HOST_NVS_PAGE_COUNT> m_pages{};
+        size_t m_active = 0;
+        std::map<std::string, Item> m_items{};
+        host::FlashStats m_stats{};
+
+        static uint32_t entry_span(nvs_type_t type, size_t len)
+        {
+            auto data_entries = static_cast<uint32_t>((len + HOST_NVS_ENTRY_SIZE - 1) / HOST_NVS_ENTRY_SIZE);
+            // strings are stored with their terminator, blobs additionally need a blob index entry
+            if (type == NVS_TYPE_STR)
+                return 1 + static_cast<uint32_t>(len / HOST_NVS_ENTRY_SIZE + 1);
+            if (type == NVS_TYPE_BLOB)
+                return 2 + data_entries;
+            return 1;
+        }
+
+        static void charge(int64_t us)
+        {
+            host::charge_us(us);
+        }
+
+        void written(uint32_t entries)
+        {
+            m_stats.entries_written += entries;
+            m_stats.flash_time_us += entries * HOST_NVS_ENTRY_WRITE_US;
+            charge(entries * HOST_NVS_ENTRY_WRITE_US);
+        }
+
+        // the first empty page besides the active one
+        [[nodiscard]] size_t reserve() const
+        {
+            for (size_t i = 0; i < m_pages.size(); ++i)
+            {
+                if (i != m_active && m_pages[i].used == 0)
+                    return i;
+            }
+            return m_pages.size();
+        }
+
+        int allocate(uint32_t span)
+        {
+            for (int attempt = 0; attempt < HOST_NVS_PAGE_COUNT; ++attempt)
+            {
+                if (m_pages[m_active].used + span <= HOST_NVS_ENTRIES_PER_PAGE)
+                {
+                    m_pages[m_active].used += span;
+                    return static_cast<int>(m_active);
+                }
+
+                // move on to a free page if one is left besides the reserve
+                auto free = std::ranges::count_if(m_pages, [](const Page& page) { return page.used == 0; });
+                if (free > 1)
+                {
+                    m_active = reserve();
+                    continue;
+                }
+
+                if (!collect())
+                    break;
+            }
+            LOG_E("Modeled NVS partition is full");
+            return -1;
+        }
+
+        bool collect()
+        {
+            size_t victim = m_pages.size();
+            for (size_t i = 0; i < m_pages.size(); ++i)
+            {
+                if (m_pages[i].used > 0 && m_pages[i].erased > 0 &&
+                    (victim == m_pages.size() || m_pages[i].erased > m_pages[victim].erased))
+                    victim = i;
+            }
+            auto target = reserve();
+            if (victim == m_pages.size() || target == m_pages.size())
+                return false;
+
+            auto live = m_pages[victim].used - m_pages[victim].erased;
+            for (auto& [name, item] : m_items)
+            {
+                if (item.page == victim)
+                    item.page = target;
+            }
+            m_pages[target].used = live;
+            m_stats.entries_relocated += live;
+            written(live);
+
+            m_pages[victim] = {.used = 0, .erased = 0, .erase_count = m_pages[victim].erase_count + 1};
+            ++m_stats.erases;
+            m_stats.flash_time_us += HOST_NVS_PAGE_ERASE_US;
+            charge(HOST_NVS_PAGE_ERASE_US);
+
+            m_active = target;
+            return true;
+        }
+
+        void load()
+        {
+            std::ifstream file(m_path);
+            if (m_path.empty() || !file)
+                return;
+
+            m_items.clear();
+            m_pages = {};
+            size_t page_index = 0;
+            std::string line;
+            while (std::getline(file, line))
+            {
+                std::istringstream in(line);
+                std::string tag;
+                in >> tag;
+                if (tag == "active")
+                {
+                    in >> m_active;
+                }
+                else if (tag == "page" && page_index < m_pages.size())
+                {
+                    auto& page = m_pages[page_index++];
+                    in >> page.erase_count >> page.used >> page.erased;
+                }
+                else if (tag == "item")
+                {
+                    std::string name, hex;
+                    int type;
+                    Item item{};
+                    in >> name >> type >> item.page >> item.span >> hex;
+                    item.type = static_cast<nvs_type_t>(type);
+                    for (size_t i = 0; i + 1 < hex.size(); i += 2)
+                        item.data.push_back(static_cast<uint8_t>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+                    m_items[name] = item;
+                }
+            }
+        }
+
+        void save()
+        {
+            if (m_path.empty())
+                return;
+
+            std::ofstream file(m_path, std::ios::trunc);
+            file << "active " << m_active << '\n';
+            for (const auto& page : m_pages)
+                file << "page " << page.erase_count << ' ' << page.used << ' ' << page.erased << '\n';
+            for (const auto& [name, item] : m_items)
+            {
+                char hex[3];
+                file << "item " << name << ' ' << item.type << ' ' << item.page << ' ' << item.span << ' ';
+                for (auto byte : item.data)
+                {
+                    snprintf(hex, sizeof(hex), "%02x", byte);
+                    file << hex;
+                }
+                // keep empty values parseable
+                file << (item.data.empty() ? "-" : "") << '\n';
+            }
+        }
+    };
+
+    Flash& flash()
+    {
+        // leaked, as values with static storage duration might be committed after this translation unit is destroyed
+        static auto* flash = new Flash{};
+        return *flash;
+    }
+}
+
+
+void host::flash_file(const char* path)
+{
+    flash().open(path ? path : "");
+}
+
+host::FlashStats host::flash_stats()
+{
+    return flash().stats();
+}
+
+
+struct nvs_opaque_iterator_t
+{
+    std::vector<nvs_entry_info_t> entries;
+    size_t index;
+};
+
+esp_err_t nvs_entry_find(const char*, const char* namespace_name, nvs_type_t type, nvs_iterator_t* output_iterator)
+{
+    auto* it = new nvs_opaque_iterator_t{};
+    for (const auto& key : flash().keys(namespace_name))
+    {
+        auto* item = flash().find(namespace_name, key);
+        if (type != NVS_TYPE_ANY && item->type != type)
+            continue;
+        nvs_entry_info_t info{};
+        info.type = item->type;
+        strncpy(info.namespace_name, namespace_name, sizeof(info.namespace_name) - 1);
+        strncpy(info.key, key.c_str(), sizeof(info.key) - 1);
+        it->entries.push_back(info);
+    }
+    if (it->entries.empty())
+    {
+        delete it;
+        *output_iterator = nullptr;
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *output_iterator = it;
+    return ESP_OK;
+}
+
+esp_err_t nvs_entry_next(nvs_iterator_t* iterator)
+{
+    if (++(*iterator)->index < (*iterator)->entries.size())
+        return ESP_OK;
+    // like the NVS library, the iterator is released when reaching the end
+    nvs_release_iterator(*iterator);
+    *iterator = nullptr;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t* out_info)
+{
+    *out_info = iterator->entries[iterator->index];
+    return ESP_OK;
+}
+
+void nvs_release_iterator(nvs_iterator_t iterator)
+{
+    delete iterator;
+}
+
+
+namespace
+{
+    // the namespaces of the open handles, which start at 1
+    std::vector<std::string> s_handles{};
+
+    template <typename T>
+    esp_err_t set(nvs_handle_t handle, const char* key, nvs_type_t type, const T* value, size_t len)
+    {
+        if (handle == 0 || handle > s_handles.size())
+            return ESP_ERR_NVS_INVALID_HANDLE;
+        return flash().set(s_handles[handle - 1], key, type, value, len) ? ESP_OK : ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+}
+
+esp_err_t nvs_open(const char* namespace_name, nvs_open_mode_t, nvs_handle_t* out_handle)
+{
+    s_handles.emplace_back(namespace_name);
+    *out_handle = static_cast<nvs_handle_t>(s_handles.size());
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t)
+{
+}
+
+esp_err_t nvs_set_i8(nvs_handle_t handle, const char* key, int8_t value)
+{
+    return set(handle, key, NVS_TYPE_I8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char* key, uint8_t value)
+{
+    return set(handle, key, NVS_TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_i16(nvs_handle_t handle, const char* key, int16_t value)
+{
+    return set(handle, key, NVS_TYPE_I16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char* key, uint16_t value)
+{
+    return set(handle, key, NVS_TYPE_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key, int32_t value)
+{
+    return set(handle, key, NVS_TYPE_I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value)
+{
+    return set(handle, key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_i64(nvs_handle_t handle, const char* key, int64_t value)
+{
+    return set(handle, key, NVS_TYPE_I64, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char* key, uint64_t value)
+{
+    return set(handle, key, NVS_TYPE_U64, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value)
+{
+    return set(handle, key, NVS_TYPE_STR, value, strlen(value));
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+    return set(handle, key, NVS_TYPE_BLOB, static_cast<const uint8_t*>(value), length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
+{
+    if (handle == 0 || handle > s_handles.size())
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    return flash().remove(s_handles[handle - 1] + '/' + key) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    if (handle == 0 || handle > s_handles.size())
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    flash().commit();
+    return ESP_OK;
+}
+
+
+bool Preferences::begin(const char* name, bool readOnly, const char*)
+{
+    m_namespace = name;
+    m_read_only = readOnly;
+    return true;
+}
+
+void Preferences::end()
+{
+    m_namespace = nullptr;
+}
+
+// like the Arduino core, each modification is committed on its own
+
+bool Preferences::clear()
+{
+    if (!m_namespace || m_read_only)
+        return false;
+    for (const auto& key : flash().keys(m_namespace))
+        flash().remove(std::string(m_namespace) + '/' + key);
+    flash().commit();
+    return true;
+}
+
+bool Preferences::remove(const char* key)
+{
+    if (!m_namespace || m_read_only)
+        return false;
+    auto removed = flash().remove(std::string(m_namespace) + '/' + key);
+    flash().commit();
+    return removed;
+}
+
+bool Preferences::isKey(const char* key)
+{
+    return m_namespace && flash().find(m_namespace, key);
+}
+
+size_t Preferences::freeEntries()
+{
+    return flash().freeEntries();
+}
+
+template <typename T>
+size_t Preferences::put(const char* key, nvs_type_t type, const T& value)
+{
+    if (!m_namespace || m_read_only)
+        return 0;
+    auto stored = flash().set(m_namespace, key, type, &value, sizeof(T));
+    flash().commit();
+    return stored ? sizeof(T) : 0;
+}
+
+template <typename T>
+T Preferences::get(const char* key, nvs_type_t type, const T& defaultValue)
+{
+    auto* item = m_namespace ? flash().find(m_namespace, key) : nullptr;
+    if (!item || item->type != type || item->data.size() != sizeof(T))
+        return defaultValue;
+    T value;
+    memcpy(&value, item->data.data(), sizeof(T));
+    return value;
+}
+
+// the type mapping follows the Arduino core; long is 32 bit wide and floating point values are stored as blobs
+
+size_t Preferences::putChar(const char* key, int8_t value) { return put(key, NVS_TYPE_I8, value); }
+size_t Preferences::putUChar(const char* key, uint8_t value) { return put(key, NVS_TYPE_U8, value); }
+size_t Preferences::putShort(const char* key, int16_t value) { return put(key, NVS_TYPE_I16, value); }
+size_t Preferences::putUShort(const char* key, uint16_t value) { return put(key, NVS_TYPE_U16, value); }
+size_t Preferences::putInt(const char* key, int32_t value) { return put(key, NVS_TYPE_I32, value); }
+size_t Preferences::putUInt(const char* key, uint32_t value) { return put(key, NVS_TYPE_U32, value); }
+size_t Preferences::putLong(const char* key, int32_t value) { return put(key, NVS_TYPE_I32, value); }
+size_t Preferences::putULong(const char* key, uint32_t value) { return put(key, NVS_TYPE_U32, value); }
+size_t Preferences::putLong64(const char* key, int64_t value) { return put(key, NVS_TYPE_I64, value); }
+size_t Preferences::putULong64(const char* key, uint64_t value) { return put(key, NVS_TYPE_U64, value); }
+size_t Preferences::putFloat(const char* key, float value) { return put(key, NVS_TYPE_BLOB, value); }
+size_t Preferences::putDouble(const char* key, double value) { return put(key, NVS_TYPE_BLOB, value); }
+size_t Preferences::putBool(const char* key, bool value) { return putUChar(key, value ? 1 : 0); }
+
+size_t Preferences::putString(const char* key, const char* value)
+{
+    auto len = strlen(value);
+    if (!m_namespace || m_read_only)
+        return 0;
+    auto stored = flash().set(m_namespace, key, NVS_TYPE_STR, value, len);
+    flash().commit();
+    return stored ? len : 0;
+}
+
+size_t Preferences::putString(const char* key, const String& value) { return putString(key, value.c_str()); }
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len)
+{
+    if (!m_namespace || m_read_only)
+        return 0;
+    auto stored = flash().set(m_namespace, key, NVS_TYPE_BLOB, value, len);
+    flash().commit();
+    return stored ? len : 0;
+}
+
+int8_t Preferences::getChar(const char* key, int8_t defaultValue) { return get(key, NVS_TYPE_I8, defaultValue); }
+uint8_t Preferences::getUChar(const char* key, uint8_t defaultValue) { return get(key, NVS_TYPE_U8, defaultValue); }
+int16_t Preferences::getShort(const char* key, int16_t defaultValue) { return get(key, NVS_TYPE_I16, defaultValue); }
+uint16_t Preferences::getUShort(const char* key, uint16_t defaultValue) { return get(key, NVS_TYPE_U16, defaultValue); }
+int32_t Preferences::getInt(const char* key, int32_t defaultValue) { return get(key, NVS_TYPE_I32, defaultValue); }
+uint32_t Preferences::getUInt(const char* key, uint32_t defaultValue) { return get(key, NVS_TYPE_U32, defaultValue); }
+int32_t Preferences::getLong(const char* key, int32_t defaultValue) { return get(key, NVS_TYPE_I32, defaultValue); }
+uint32_t Preferences::getULong(const char* key, uint32_t defaultValue) { return get(key, NVS_TYPE_U32, defaultValue); }
+int64_t Preferences::getLong64(const char* key, int64_t defaultValue) { return get(key, NVS_TYPE_I64, defaultValue); }
+uint64_t Preferences::getULong64(const char* key, uint64_t defaultValue) { return get(key, NVS_TYPE_U64, defaultValue); }
+float Preferences::getFloat(const char* key, float defaultValue) { return get(key, NVS_TYPE_BLOB, defaultValue); }
+double Preferences::getDouble(const char* key, double defaultValue) { return get(key, NVS_TYPE_BLOB, defaultValue); }
+bool Preferences::getBool(const char* key, bool defaultValue) { return getUChar(key, defaultValue ? 1 : 0) == 1; }
+
+String Preferences::getString(const char* key, const String& defaultValue)
+{
+    auto* item = m_namespace ? flash().find(m_namespace, key) : nullptr;
+    if (!item || item->type != NVS_TYPE_STR)
+        return defaultValue;
+    return std::string(item->data.begin(), item->data.end());
+}
+
+size_t Preferences::getBytesLength(const char* key)
+{
+    auto* item = m_namespace ? flash().find(m_namespace, key) : nullptr;
+    return item && item->type == NVS_TYPE_BLOB ? item->data.size() : 0;
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen)
+{
+    auto* item = m_namespace ? flash().find(m_namespace, key) : nullptr;
+    if (!item || item->type != NVS_TYPE_BLOB || item->data.size() > maxLen)
+        return 0;
+    memcpy(buf, item->data.data(), item->data.size());
+    return item->data.size();
+}
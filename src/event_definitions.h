@@ -18,7 +18,11 @@ enum ALARM_EVENT_ID
     //! Set the current alarm to snooze
     SNOOZE,
     //! Deactivate the current alarm
-    DEACTIVATE
+    DEACTIVATE,
+    //! An enabled alarm was set; the index of the alarm (0 or 1) is included in the event data
+    ALARM_SET,
+    //! The sound of an enabled alarm was changed; the index of the alarm (0 or 1) is included in the event data
+    SOUND_CHANGED,
 };
 
 
@@ -68,4 +72,28 @@ enum SENSOR_EVENT_ID
 };
 
 
+//! Audio events
+EVENT_DEFINE(AUDIO_EVENT);
+
+enum AUDIO_EVENT_ID
+{
+    //! Playback of a sound was started
+    PLAYBACK_STARTED,
+    //! Playback was stopped or has ended
+    PLAYBACK_STOPPED,
+};
+
+
+//! Sound library events
+EVENT_DEFINE(SOUND_EVENT);
+
+enum SOUND_EVENT_ID
+{
+    //! The sound indexer completed a directory; the number of sounds found so far is included in the event data
+    INDEX_PROGRESS,
+    //! The sound indexer completed scanning; the number of sounds found is included in the event data
+    INDEX_COMPLETED,
+};
+
+
 #endif //EVENT_DEFINITIONS_H
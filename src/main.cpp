@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <ArduinoJson.h>
 #include <SD.h>
 
 #include "modules/input_handler.h"
@@ -15,7 +16,10 @@
 #include "matrix_font.h"
 #include "u8g2_fonts.h"
 #include "pin_map.h"
+#include "util/timer.h"
+#include <memory>
 #include <utility>
+#include <vector>
 
 #ifdef ENV_DEBUG
 #define DEBUG_ONLY(x) x
@@ -73,6 +77,11 @@ static void matrix_hum(char* buf, size_t size);
 [[maybe_unused]] static AudioController audio{pins::i2s_data, pins::i2s_bck, pins::i2s_lrc};
 
 
+//! Imports uploaded NVS snapshots on the timer worker, as committing them and notifying the observers might block,
+//! which must not happen on the AsyncTCP task; a snapshot uploaded before the previous one was imported replaces it
+static Timer nvs_import_timer{"nvs import"};
+
+
 constexpr auto c_nvv_tmp_arr_size = 16;
 /**
  * An array for temporarily storing NVV values to be used inside the MUI
@@ -125,6 +134,9 @@ static UiDisplayManager ui{
 };
 
 
+[[maybe_unused]] static SoundManager sounds{"/sounds.idx", "/sounds.json"};
+
+
 int x{};
 using namespace endpoint;
 [[maybe_unused]] static WebServiceManager services{
@@ -138,10 +150,79 @@ using namespace endpoint;
     Endpoint::at("/bar").put(x),
     Endpoint::at("/static").file("/static.html", SD),
     Endpoint::at("/static").dir("/static/files", SD),
+    Endpoint::at("/nvs").get([](AsyncWebServerRequest* request)
+    {
+        auto snapshot = NVS::exportSnapshot();
+        auto* response = request->beginResponseStream("application/octet-stream");
+        response->write(snapshot.data(), snapshot.size());
+        request->send(response);
+    }),
+    Endpoint::at("/nvs").put([](BRequest& r)
+    {
+        // the body is freed with the request, so the import gets a copy
+        auto snapshot = std::make_shared<std::vector<uint8_t>>(r.body.begin(), r.body.end());
+        nvs_import_timer.setDeferred(true);
+        nvs_import_timer.once(1, [snapshot] { NVS::importSnapshot(snapshot->data(), snapshot->size()); }, true);
+        r->send(202 /*Accepted*/);
+    }),
+    Endpoint::at("/sounds").get([](AsyncWebServerRequest* request)
+    {
+        // a page of sounds, so large libraries are never serialized at once: /sounds?offset=0&limit=50&filter=abc
+        auto param = [request](const char* name) { return request->hasParam(name) ? request->getParam(name)->value() : String{}; };
+        auto offset = param("offset").toInt();
+        auto limit = request->hasParam("limit") ? param("limit").toInt() : 50;
+        auto filter = param("filter");
+        if (offset < 0 || limit < 0 || limit > 500)
+        {
+            request->send(400 /*Bad Request*/);
+            return;
+        }
+
+        auto* response = request->beginResponseStream("application/json");
+        response->print("{\"sounds\":[");
+        JsonDocument doc;
+        auto total = sounds.list(offset, limit, filter.c_str(), [&](const SoundTable::View& sound, size_t i)
+        {
+            if (i > static_cast<size_t>(offset))
+                response->print(',');
+            doc.set(sound);
+            serializeJson(doc, *response);
+        });
+        response->printf("],\"total\":%u}", total);
+        request->send(response);
+    }),
+    Endpoint::at("/sounds/rescan").post([](AsyncWebServerRequest* request)
+    {
+        sounds.rescan();
+        request->send(202 /*Accepted*/);
+    }),
 };
 
 
-[[maybe_unused]] static SoundManager sounds{"/sounds.json"};
+//! Decodes the beginning of an alarm's sound in advance, so it starts playing without delay;
+//! a random sound is only drawn when the alarm triggers, so the sound the deck yields next is prepared
+static void prepare_alarm_sound(uint8_t slot)
+{
+    auto number = (slot == 0 ? rtc.alarm1 : rtc.alarm2).sound.read();
+    if (auto sound = number == 0 ? sounds.peekRandom() : sounds[number])
+        audio.prepareAlarm(slot, sound->path());
+    else
+        audio.prepareAlarm(slot);
+}
+
+//! Plays an alarm's sound, drawing a random sound from the deck, which is the prepared one unless the sounds changed
+static void play_alarm_sound(uint8_t slot)
+{
+    if ((slot == 0 ? rtc.alarm1 : rtc.alarm2).sound.read() == 0)
+    {
+        if (auto sound = sounds[0])
+            audio.prepareAlarm(slot, sound->path());
+        // the other alarm might have prepared the card drawn now
+        if ((slot == 0 ? rtc.alarm2 : rtc.alarm1).sound.read() == 0)
+            prepare_alarm_sound(1 - slot);
+    }
+    audio.playAlarm(slot);
+}
 
 
 void setup()
@@ -165,6 +246,30 @@ void setup()
     {
         lights.max();
     };
+    ALARM_EVENT >> TRIGGERED_1 >> [](auto)
+    {
+        play_alarm_sound(0);
+    };
+    ALARM_EVENT >> TRIGGERED_2 >> [](auto)
+    {
+        play_alarm_sound(1);
+    };
+    ALARM_EVENT >> SNOOZE >> [](auto)
+    {
+        audio.stop();
+    };
+    ALARM_EVENT >> DEACTIVATE >> [](auto)
+    {
+        audio.stop();
+    };
+    ALARM_EVENT >> ALARM_SET >> [](const Event_t& e)
+    {
+        prepare_alarm_sound(e.data<uint8_t>());
+    };
+    ALARM_EVENT >> SOUND_CHANGED >> [](const Event_t& e)
+    {
+        prepare_alarm_sound(e.data<uint8_t>());
+    };
     INPUT_EVENT >> CLICK_LEFT >> [](auto)
     {
         if (ui.active())
@@ -227,12 +332,18 @@ void setup()
 
     BootProcess::runAll();
 
+    // alarms restored from NVS were set before the listener was registered
+    prepare_alarm_sound(0);
+    prepare_alarm_sound(1);
 
     rtc.alarm1.setIn8h();
-    rtc.alarm2.hour = 8;
-    rtc.alarm2.minute = 30;
-    rtc.alarm2.enabled = true;
-    rtc.alarm2.repeat = 1 << 4;
+    {
+        NVS::Transaction transaction;
+        rtc.alarm2.hour = 8;
+        rtc.alarm2.minute = 30;
+        rtc.alarm2.enabled = true;
+        rtc.alarm2.repeat = 1 << 4;
+    }
 
 
     DEBUG_ONLY(delay(1000));
@@ -1,6 +1,88 @@
 #include "audio_controller.h"
 
 #include <SD.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include "event_definitions.h"
+#include "log.h"
+
+
+// bytes of a cache played per iteration of the audio task, between which the decoder is run
+static constexpr size_t c_cache_chunk = 1024;
+
+
+/**
+ * Print collecting decoded samples into a fixed buffer, dropping the samples exceeding it
+ */
+struct PcmSink final : Print
+{
+    uint8_t* data;
+    size_t capacity;
+    size_t size{};
+
+    PcmSink(uint8_t* data, size_t capacity) : data(data), capacity(capacity) {}
+    size_t write(uint8_t byte) override { return write(&byte, 1); }
+
+    size_t write(const uint8_t* buffer, size_t length) override
+    {
+        auto copied = std::min(length, capacity - size);
+        memcpy(data + size, buffer, copied);
+        size += copied;
+        return length;
+    }
+};
+
+/**
+ * Decodes the beginning of an MP3 stream into a buffer allocated in PSRAM
+ * @param input The MP3 stream
+ * @param seconds The duration to decode
+ * @param info Set to the audio info of the decoded samples
+ * @param size Set to the size of the decoded samples in bytes
+ * @return The decoded samples, to be freed using heap_caps_free, or nullptr on failure
+ */
+static uint8_t* decode(Stream& input, size_t seconds, audio_tools::AudioInfo& info, size_t& size)
+{
+    // the size of the samples is only known after the first frame, so the largest possible size is allocated:
+    // 48 kHz, stereo, 16 bit, plus one frame of 1152 samples
+    auto capacity = (48000 * seconds + 1152) * 2 * sizeof(int16_t);
+    auto* buffer = static_cast<uint8_t*>(heap_caps_malloc(capacity, MALLOC_CAP_SPIRAM));
+    if (!buffer)
+        return nullptr;
+
+    PcmSink sink{buffer, capacity};
+    auto decoder = std::make_unique<audio_tools::MP3DecoderHelix>();
+    decoder->setOutput(sink);
+    decoder->begin();
+    size_t limit = capacity;
+    uint8_t chunk[512];
+    while (sink.size < limit)
+    {
+        auto length = input.readBytes(chunk, sizeof(chunk));
+        if (length == 0)
+            break;
+        decoder->write(chunk, length);
+        if (limit == capacity && sink.size > 0)
+        {
+            info = decoder->audioInfo();
+            limit = std::min<size_t>(capacity, info.sample_rate * info.channels * info.bits_per_sample / 8 * seconds);
+        }
+    }
+    decoder->end();
+
+    size = std::min(sink.size, limit);
+    if (size == 0)
+    {
+        heap_caps_free(buffer);
+        return nullptr;
+    }
+    // release the unused capacity; shrinking keeps the buffer if reallocating fails
+    if (auto* shrunk = static_cast<uint8_t*>(heap_caps_realloc(buffer, size, MALLOC_CAP_SPIRAM)))
+        buffer = shrunk;
+    return buffer;
+}
 
 
 AudioController::AudioController(uint8_t pin_data, uint8_t pin_bck, uint8_t pin_lrc)
@@ -14,26 +96,48 @@ AudioController::AudioController(uint8_t pin_data, uint8_t pin_bck, uint8_t pin_
 
 void AudioController::play(const char* path)
 {
-    if (m_player.setPath(path))
-    {
-        m_source.setLoop(false);
-        m_player.play();
-    }
+    post({.kind = Command::play, .path = path ? path : "", .loop = false});
 }
 
 void AudioController::playLooped(const char* path)
 {
-    if (m_player.setPath(path))
+    post({.kind = Command::play, .path = path ? path : "", .loop = true});
+}
+
+void AudioController::stop()
+{
+    post({.kind = Command::stop});
+}
+
+void AudioController::setMuted(bool muted)
+{
+    m_output.gain.setMuted(muted);
+}
+
+void AudioController::prepareAlarm(uint8_t slot, const char* path)
+{
+    if (slot >= c_alarm_slots)
+        return;
+
     {
-        m_source.setLoop(true);
-        m_player.play();
+        std::scoped_lock lock{m_cache_mutex};
+        auto& cache = m_caches[slot];
+        String new_path{path ? path : ""};
+        if (cache.prepared && cache.path == new_path)
+            return;
+        cache.path = new_path;
+        cache.prepared = true;
+        cache.pending = true;
+        cache.stale = true;
     }
+    // decoding takes a few hundred milliseconds, so it is done by the cache decoder task
+    m_cache_timer.reset();
 }
 
-void AudioController::stop()
+void AudioController::playAlarm(uint8_t slot)
 {
-    m_player.stop();
-    suspend();
+    if (slot < c_alarm_slots)
+        post({.kind = Command::alarm, .slot = slot, .time = esp_timer_get_time()});
 }
 
 NVV<uint8_t>& AudioController::volume()
@@ -43,23 +147,348 @@ NVV<uint8_t>& AudioController::volume()
 
 void AudioController::runBootProcess()
 {
-    m_volume.observe([this](uint8_t volume) { m_player.setVolume(static_cast<float>(volume) / 100.f); });
+    // the volume is applied by the output stage, as the cached samples don't pass the player
+    m_volume.observe([this](uint8_t volume) { m_output.gain.setLevel(Q15Gain::fromPercent(volume)); });
 
     m_memory_manager.begin(static_cast<int>(ESP.getPsramSize()) / 2);
     m_i2s.begin(m_i2s_config);
-    m_player.setVolume(static_cast<float>(*m_volume) / 100.f);
+    // the player's volume stream passes samples unchanged at full volume
+    m_player.setVolume(1.f);
+    m_output.gain.setLevel(Q15Gain::fromPercent(m_volume.read()));
     m_player.begin(-1, false);
     m_player.setAutoNext(false);
 
-    suspend();
+    m_cache_timer.once(AUDIO_ALARM_CACHE_DELAY, [this] { m_cache_decoder.wake.offer(true); });
+    // alarms may have been prepared before booting
+    m_cache_timer.reset();
 }
 
 void AudioController::run()
 {
-    if (!m_player.copy())
+    // while idle, the task waits for a command; while playing, it checks for one before each chunk
+    bool woken = true;
+    if (!m_playing)
+        m_wake.take(woken);
+    else if (!m_wake.poll(woken))
+        woken = false;
+    if (woken)
+    {
+        std::unique_lock lock{m_command_mutex};
+        auto command = std::exchange(m_command, std::nullopt);
+        lock.unlock();
+        if (command)
+            execute(*command);
+        if (!m_playing)
+            return;
+    }
+
+    if (auto position = m_cache_position.load(); position != SIZE_MAX)
+    {
+        const uint8_t* chunk = nullptr;
+        size_t length = 0;
+        {
+            std::scoped_lock lock{m_cache_mutex};
+            auto& cache = m_caches[m_cache_slot];
+            if (position < cache.size)
+            {
+                chunk = cache.pcm + position;
+                length = std::min(c_cache_chunk, cache.size - position);
+            }
+        }
+
+        // a cache isn't replaced while it is played, so it is written without holding the lock,
+        // which would block preparing an alarm while I2S blocks
+        if (length > 0)
+        {
+            m_output.writeCached(chunk, length);
+            m_cache_position = position + length;
+
+            // the decoder runs faster than real time, so it catches up while the cached samples are played
+            if (m_output.skipping())
+                m_player.copy();
+            return;
+        }
+
+        m_cache_position = SIZE_MAX;
+        m_output.release();
+    }
+
+    // a read of the file times out while the SD card is busy, which must not end the sound
+    if (m_player.copy() || !m_source.ended())
+        return;
+
+    // a looped file only ends if it can't be read anymore, so an alarm keeps sounding with the default sound
+    if (m_loop && !m_source.playingDefault() && m_player.setPath(nullptr))
+    {
+        LOG_W("Looped sound ended unexpectedly, continuing with the default sound");
+        m_source.setLoop(true);
+        m_player.play();
+        return;
+    }
+    finish();
+}
+
+void AudioController::post(Command command)
+{
+    {
+        std::scoped_lock lock{m_command_mutex};
+        m_command = std::move(command);
+    }
+    // a wake-up already queued executes the replaced command
+    m_wake.offer(true);
+}
+
+void AudioController::execute(const Command& command)
+{
+    switch (command.kind)
+    {
+    case Command::play:
+        start(command.path.isEmpty() ? nullptr : command.path.c_str(), command.loop);
+        break;
+    case Command::alarm:
+        startAlarm(command.slot, command.time);
+        break;
+    case Command::stop:
+        if (m_playing)
+        {
+            m_player.stop();
+            finish();
+        }
+        break;
+    }
+}
+
+void AudioController::start(const char* path, bool loop)
+{
+    m_cache_position = SIZE_MAX;
+    m_output.reset();
+    m_output.gain.cancelFade();
+    if (m_player.setPath(path))
+    {
+        m_source.setLoop(loop);
+        m_player.play();
+        m_playing = true;
+        m_loop = loop;
+        AUDIO_EVENT << PLAYBACK_STARTED;
+    }
+}
+
+void AudioController::startAlarm(uint8_t slot, int64_t time)
+{
+    std::unique_lock lock{m_cache_mutex};
+    auto& cache = m_caches[slot];
+    // samples decoded for a sound prepared before are not played
+    auto cached = cache.pcm && !cache.stale;
+    m_cache_position = SIZE_MAX;
+    m_output.reset();
+    if (!m_player.setPath(cache.path.isEmpty() ? nullptr : cache.path.c_str()))
     {
-        suspend();
+        // an alarm must never be silent, so the default sound is played if the file can't be opened
+        LOG_E("Failed to play alarm sound %s, playing the default sound", cache.path.c_str());
+        cached = false;
+        if (!m_player.setPath(nullptr))
+            return;
     }
+    m_output.markTrigger(cached, time);
+    m_source.setLoop(true);
+    m_output.gain.fade(0, Q15Gain::c_unity, AUDIO_ALARM_FADE_SECONDS * 1000);
+
+    // the decoder starts from the beginning as well, its samples are dropped until the cached ones were played
+    if (cached)
+    {
+        m_output.setAudioInfo(cache.info);
+        m_output.skip(cache.size);
+        m_cache_slot = slot;
+        m_cache_position = 0;
+    }
+    lock.unlock();
+
+    m_player.play();
+    m_playing = true;
+    m_loop = true;
+    AUDIO_EVENT << PLAYBACK_STARTED;
+}
+
+void AudioController::finish()
+{
+    m_playing = false;
+    m_cache_position = SIZE_MAX;
+    m_output.reset();
+    m_source.logStats();
+    m_output.logStats();
+    AUDIO_EVENT << PLAYBACK_STOPPED;
+}
+
+void AudioController::fillCaches()
+{
+    for (uint8_t slot = 0; slot < c_alarm_slots; ++slot)
+    {
+        String path;
+        {
+            std::scoped_lock lock{m_cache_mutex};
+            auto& cache = m_caches[slot];
+            if (!cache.pending)
+                continue;
+            // a cache must not be replaced while it is played
+            if (m_cache_position != SIZE_MAX && m_cache_slot == slot)
+            {
+                m_cache_timer.reset();
+                continue;
+            }
+            cache.pending = false;
+            path = cache.path;
+        }
+
+        auto start = esp_timer_get_time();
+        audio_tools::AudioInfo info{};
+        size_t size = 0;
+        uint8_t* pcm = nullptr;
+        if (AUDIO_ALARM_CACHE_SECONDS > 0)
+        {
+            if (path.isEmpty())
+            {
+                audio_tools::MemoryStream input{default_mp3_start, default_mp3_end - default_mp3_start};
+                input.begin();
+                pcm = decode(input, AUDIO_ALARM_CACHE_SECONDS, info, size);
+            }
+            else if (auto file = SD.open(path))
+            {
+                pcm = decode(file, AUDIO_ALARM_CACHE_SECONDS, info, size);
+            }
+        }
+
+        {
+            std::scoped_lock lock{m_cache_mutex};
+            auto& cache = m_caches[slot];
+            // the alarm's sound may have been changed meanwhile, which is decoded by the next run
+            if (cache.pending || cache.path != path)
+            {
+                heap_caps_free(pcm);
+                continue;
+            }
+            // the alarm may have started playing the previous samples meanwhile, which must stay valid
+            if (m_cache_position != SIZE_MAX && m_cache_slot == slot)
+            {
+                cache.pending = true;
+                m_cache_timer.reset();
+                heap_caps_free(pcm);
+                continue;
+            }
+            std::swap(cache.pcm, pcm);
+            cache.size = size;
+            cache.info = info;
+            cache.stale = false;
+        }
+        heap_caps_free(pcm);
+
+        if (size > 0)
+        {
+            LOG_I("Decoded %u ms of alarm #%u's sound %s into %u bytes in %lld us",
+                  size * 1000 / (info.sample_rate * info.channels * info.bits_per_sample / 8), slot + 1,
+                  path.isEmpty() ? "(default)" : path.c_str(), size, esp_timer_get_time() - start);
+        }
+        else if (AUDIO_ALARM_CACHE_SECONDS > 0)
+        {
+            LOG_W("Failed to decode alarm #%u's sound %s", slot + 1, path.c_str());
+        }
+    }
+}
+
+AudioController::CacheDecoder::CacheDecoder(AudioController& audio) :
+    // the task must not start before the queue was constructed
+    Thread({.name = "alarm cache", .priority = 1, .autostart = false}),
+    audio(audio)
+{
+    startTask();
+}
+
+void AudioController::CacheDecoder::run()
+{
+    bool woken;
+    wake.take(woken);
+    audio.fillCaches();
+}
+
+size_t AudioController::Output::write(const uint8_t* data, size_t length)
+{
+    auto dropped = std::min(skip_bytes, length);
+    skip_bytes -= dropped;
+    if (dropped == length)
+        return length;
+
+    if (holding)
+    {
+        held.insert(held.end(), data + dropped, data + length);
+        return length;
+    }
+    return dropped + forward(data + dropped, length - dropped);
+}
+
+void AudioController::Output::setAudioInfo(audio_tools::AudioInfo info)
+{
+    AudioOutput::setAudioInfo(info);
+    gain.setFormat(info.sample_rate, info.channels);
+    // reconfiguring I2S while playing a cache of the same sound would cause a gap
+    if (i2s.audioInfo() != info)
+        i2s.setAudioInfo(info);
+}
+
+void AudioController::Output::skip(size_t bytes)
+{
+    skip_bytes = bytes;
+    holding = true;
+    held.clear();
+}
+
+void AudioController::Output::release()
+{
+    holding = false;
+    if (!held.empty())
+        forward(held.data(), held.size());
+    held.clear();
+    held.shrink_to_fit();
+}
+
+void AudioController::Output::reset()
+{
+    skip_bytes = 0;
+    holding = false;
+    held.clear();
+}
+
+void AudioController::Output::markTrigger(bool cached, int64_t time)
+{
+    trigger_cached = cached;
+    trigger_time = time;
+}
+
+size_t AudioController::Output::forward(const uint8_t* data, size_t length)
+{
+    if (auto trigger = std::exchange(trigger_time, 0); trigger != 0)
+    {
+        LOG_I("Alarm sound started %lld us after the trigger (%s)",
+              esp_timer_get_time() - trigger, trigger_cached ? "pre-decoded" : "decoded from file");
+    }
+    if (gain.bypassed())
+        return i2s.write(data, length);
+
+    // the decoder outputs 16 bit samples
+    auto samples = length / sizeof(int16_t);
+    scaled.resize(samples);
+    memcpy(scaled.data(), data, samples * sizeof(int16_t));
+    auto start = ESP.getCycleCount();
+    gain.apply(scaled.data(), samples);
+    gain_cycles += ESP.getCycleCount() - start;
+    gain_frames += samples / std::max<uint8_t>(audioInfo().channels, 1);
+    return i2s.write(reinterpret_cast<const uint8_t*>(scaled.data()), samples * sizeof(int16_t));
+}
+
+void AudioController::Output::logStats()
+{
+    if (gain_frames >= 1000)
+        LOG_D("Gain stage used %llu CPU cycles per 1000 frames", gain_cycles * 1000 / gain_frames);
+    gain_cycles = 0;
+    gain_frames = 0;
 }
 
 void AudioController::AudioSource::begin()
@@ -69,31 +498,42 @@ void AudioController::AudioSource::begin()
 
 Stream* AudioController::AudioSource::nextStream(int)
 {
+    read_ahead.end();
     file_loop.begin();
-    return &file_loop;
+    current = read_ahead.begin(file_loop) ? static_cast<Stream*>(&read_ahead) : &file_loop;
+    return current;
 }
 
 Stream* AudioController::AudioSource::selectStream(const char* path)
 {
+    // the reader task must release the file before it is changed
+    read_ahead.end();
     file_loop.end();
     default_mp3.end();
 
     if (!path)
     {
         default_mp3.begin();
-        return &default_mp3;
+        current = &default_mp3;
+        return current;
     }
 
-    if (strcmp(path, file_loop.file().path()) == 0)
+    // the file is only reopened if a different sound is selected
+    if (auto file = file_loop.file(); !file || strcmp(path, file.path()) != 0)
     {
-        if (auto file = SD.open(path))
+        file = SD.open(path);
+        if (!file)
         {
-            file_loop.setFile(file);
+            // the file of the sound selected before must not be played instead
+            current = nullptr;
+            return nullptr;
         }
+        file_loop.setFile(file);
     }
 
     file_loop.begin();
-    return &file_loop;
+    current = read_ahead.begin(file_loop) ? static_cast<Stream*>(&read_ahead) : &file_loop;
+    return current;
 }
 
 void AudioController::AudioSource::setLoop(bool loop)
@@ -101,3 +541,17 @@ void AudioController::AudioSource::setLoop(bool loop)
     file_loop.setLoopCount(loop ? -1 : 0);
     default_mp3.setLoop(loop);
 }
+
+bool AudioController::AudioSource::ended() const
+{
+    // the files and the default sound only return no data at their end
+    return current != &read_ahead || read_ahead.ended();
+}
+
+void AudioController::AudioSource::logStats()
+{
+    auto stats = read_ahead.stats();
+    if (stats.underruns > 0)
+        LOG_W("Sound playback had %lu read underruns waiting %lu ms", stats.underruns, stats.wait_ms);
+    LOG_D("Read ahead %lu bytes, lowest buffer level %lu bytes", stats.bytes, stats.min_level);
+}
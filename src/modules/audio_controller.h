@@ -4,19 +4,61 @@
 #include "util/boot_process.hpp"
 #include "util/thread.hpp"
 #include "util/nvs.hpp"
+#include "util/timer.h"
+#include "util/q15_gain.hpp"
+#include "util/blocking_queue.hpp"
 #include "default_mp3.h"
+#include "read_ahead_stream.h"
 #include <AudioTools.h>
 #include <AudioTools/AudioLibs/MemoryManager.h>
 #include <AudioTools/AudioCodecs/CodecMP3Helix.h>
 #include <AudioTools/Disk/FileLoop.h>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <optional>
+
+#ifndef AUDIO_ALARM_CACHE_SECONDS
+// seconds of each alarm's sound decoded in advance, which are played while the decoder starts
+#define AUDIO_ALARM_CACHE_SECONDS 3
+#endif
+
+#ifndef AUDIO_ALARM_CACHE_DELAY
+// seconds to wait after an alarm was set before decoding its sound, so a burst of changes is decoded once
+#define AUDIO_ALARM_CACHE_DELAY 5
+#endif
+
+#ifndef AUDIO_ALARM_CACHE_STACK_SIZE
+// stack size of the task decoding the alarm caches, which runs an MP3 decoder of its own
+#define AUDIO_ALARM_CACHE_STACK_SIZE 6144
+#endif
+
+#ifndef AUDIO_ALARM_FADE_SECONDS
+// seconds over which an alarm's sound fades in from silence to the volume; 0 starts at the volume
+#define AUDIO_ALARM_FADE_SECONDS 120
+#endif
 
 
 /**
  * Class for controlling the audio playback and volume
+ *
+ * The beginning of each alarm's sound is decoded into PSRAM by a low priority task when the alarm is set,
+ * so an alarm starts playing
+ * the decoded samples immediately; meanwhile the decoder starts on the file, and its output replaces
+ * the decoded samples once they were played
+ *
+ * The volume is applied by a fixed-point gain stage in front of I2S, which also fades in alarms
+ *
+ * The playback is only changed by the audio task: the methods starting and stopping it post a command,
+ * which the audio task executes between two chunks of samples or as soon as it is woken while idle;
+ * a command replaces one posted before that wasn't executed yet
  */
 class AudioController final : BootProcess, Thread<>
 {
 public:
+    //! Number of alarms whose sounds can be prepared
+    static constexpr uint8_t c_alarm_slots = 2;
+
     AudioController(uint8_t pin_data, uint8_t pin_bck, uint8_t pin_lrc);
 
     /**
@@ -36,6 +78,27 @@ public:
      */
     void stop();
 
+    /**
+     * Silences the playback instantly without stopping it, e.g., an alarm keeps fading in while muted
+     * @param muted Whether the output is muted
+     */
+    void setMuted(bool muted);
+
+    /**
+     * Decodes the beginning of an alarm's sound in the background, replacing the sound prepared before
+     * @param slot The index of the alarm
+     * @param path The path of the sound file to prepare; if omitted, the default sound is prepared
+     */
+    void prepareAlarm(uint8_t slot, const char* path = nullptr);
+
+    /**
+     * Plays the sound prepared for an alarm in a loop, starting with its decoded samples if they are available
+     * and fading in over AUDIO_ALARM_FADE_SECONDS; if the sound's file can't be opened, the default sound is played;
+     * the time from calling this method to handing the first samples to I2S is logged
+     * @param slot The index of the alarm
+     */
+    void playAlarm(uint8_t slot);
+
     /**
      * Get an accessor the audio volume NVS value
      * @return A reference to the audio volume value
@@ -43,8 +106,108 @@ public:
     NVV<uint8_t>& volume();
 
 private:
+    /**
+     * Request to change the playback, executed by the audio task
+     */
+    struct Command
+    {
+        enum Kind : uint8_t { play, alarm, stop };
+
+        Kind kind{stop};
+        //! The path of the sound file to play; empty for the default sound
+        String path{};
+        bool loop{false};
+        //! The index of the alarm to play
+        uint8_t slot{};
+        //! When the alarm was triggered, for logging the latency
+        int64_t time{};
+    };
+
     void runBootProcess() override;
     void run() override;
+    void post(Command command);
+    void execute(const Command& command);
+    void start(const char* path, bool loop);
+    void startAlarm(uint8_t slot, int64_t time);
+    void finish();
+    void fillCaches();
+
+    /**
+     * Decoded beginning of an alarm's sound
+     */
+    struct Cache
+    {
+        //! The path of the sound file; empty for the default sound
+        String path{};
+        //! Whether the cache needs to be decoded again
+        bool pending{false};
+        //! Whether a sound was prepared, even if its decoding failed
+        bool prepared{false};
+        //! Whether the decoded samples belong to the sound prepared before
+        bool stale{false};
+        audio_tools::AudioInfo info{};
+        uint8_t* pcm{};
+        size_t size{};
+    };
+
+    /**
+     * Output stage in front of I2S, which drops the decoded samples already played from a cache
+     * and holds back the following ones until the cache was played completely, applying the gain to all samples;
+     * only used by the audio task, except for the gain
+     */
+    // ReSharper disable once CppPolymorphicClassWithNonVirtualPublicDestructor
+    struct Output final : audio_tools::AudioOutput
+    {
+        explicit Output(audio_tools::I2SStream& i2s) : i2s(i2s) {}
+        size_t write(const uint8_t* data, size_t length) override;
+        void setAudioInfo(audio_tools::AudioInfo info) override;
+        int availableForWrite() override { return i2s.availableForWrite(); }
+        //! Writes samples bypassing the dropping and holding back, i.e., the samples of a cache
+        size_t writeCached(const uint8_t* data, size_t length) { return forward(data, length); }
+        //! Starts dropping the given number of bytes written
+        void skip(size_t bytes);
+        //! Writes the samples held back and passes further samples on
+        void release();
+        //! Discards any samples held back
+        void reset();
+        [[nodiscard]] bool skipping() const { return skip_bytes > 0; }
+        //! Marks the start of an alarm triggered at the given time, whose latency is logged on the next write
+        void markTrigger(bool cached, int64_t time);
+        //! Logs the CPU cycles spent on the gain since the last call
+        void logStats();
+
+        Q15Gain gain{};
+
+    private:
+        size_t forward(const uint8_t* data, size_t length);
+
+        audio_tools::I2SStream& i2s;
+        size_t skip_bytes{};
+        bool holding{false};
+        std::vector<uint8_t> held{};
+        int64_t trigger_time{};
+        bool trigger_cached{false};
+        // the written samples are const, so they are copied for applying the gain
+        std::vector<int16_t> scaled{};
+        uint64_t gain_cycles{};
+        uint64_t gain_frames{};
+    };
+
+    /**
+     * Task decoding the alarm caches, so decoding blocks neither the playback nor the timer worker
+     */
+    struct CacheDecoder final : Thread<AUDIO_ALARM_CACHE_STACK_SIZE>
+    {
+        explicit CacheDecoder(AudioController& audio);
+
+        ESPQueue<1, bool> wake{};
+
+    protected:
+        void run() override;
+
+    private:
+        AudioController& audio;
+    };
 
     // ReSharper disable once CppPolymorphicClassWithNonVirtualPublicDestructor
     struct AudioSource final : audio_tools::AudioSource
@@ -53,9 +216,16 @@ private:
         Stream* nextStream(int) override;
         Stream* selectStream(const char* path) override;
         void setLoop(bool loop);
+        //! Whether the current stream ended, unlike a read of the SD card timing out
+        [[nodiscard]] bool ended() const;
+        [[nodiscard]] bool playingDefault() const { return current == &default_mp3; }
+        void logStats();
 
     private:
+        Stream* current{};
         audio_tools::FileLoop file_loop{};
+        // files are read ahead by a separate task, so SD contention doesn't stall the decoder
+        ReadAheadStream read_ahead{};
         audio_tools::MemoryStream default_mp3{default_mp3_start, default_mp3_end - default_mp3_start};
     };
 
@@ -65,7 +235,27 @@ private:
     audio_tools::I2SStream m_i2s{};
     audio_tools::MP3DecoderHelix m_decoder{};
     AudioSource m_source{};
-    audio_tools::AudioPlayer m_player{m_source, m_i2s, m_decoder};
+    Output m_output{m_i2s};
+    audio_tools::AudioPlayer m_player{m_source, m_output, m_decoder};
+
+    // the command posted last, which the audio task is woken for
+    std::mutex m_command_mutex{};
+    std::optional<Command> m_command{};
+    ESPQueue<1, bool> m_wake{};
+    // whether a sound is played and whether it is looped; only accessed by the audio task
+    bool m_playing{false};
+    bool m_loop{false};
+
+    // guards the caches against being replaced while played
+    std::mutex m_cache_mutex{};
+    std::array<Cache, c_alarm_slots> m_caches{};
+    // wakes the cache decoder after the alarms were set
+    Timer m_cache_timer{"alarm sound cache"};
+    CacheDecoder m_cache_decoder{*this};
+    // the slot of the cache being played and the position within it; SIZE_MAX if no cache is played;
+    // only changed by the audio task, which starts playing a cache while holding the cache lock
+    uint8_t m_cache_slot{};
+    std::atomic<size_t> m_cache_position{SIZE_MAX};
 };
 
 
@@ -55,7 +55,7 @@ void LightsController::runBootProcess()
 
 #ifndef WOKWI
     // WOKWI doesn't like this timer :(
-    m_autoOffTimer.once(*m_autoOffDuration * 60, [this] { off(); });
+    m_autoOffTimer.once(m_autoOffDuration.read() * 60, [this] { off(); });
 #endif
     m_autoOffDuration.observe([this](uint8_t duration) { m_autoOffTimer.changePeriod(duration * 60); });
 }
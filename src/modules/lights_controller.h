@@ -66,7 +66,7 @@ private:
     uint32_t m_target = 0;
     uint32_t m_current = 0;
     NVV<uint8_t> m_autoOffDuration{"light_duration", 45};
-    Timer m_autoOffTimer;
+    Timer m_autoOffTimer{"lights off"};
     Config m_cfg;
 };
 
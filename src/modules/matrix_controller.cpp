@@ -89,7 +89,7 @@ void MatrixController::runBootProcess()
     }
 }
 
-void MatrixController::run()
+void MatrixController::tick()
 {
     if (!m_initialized)
     {
@@ -103,8 +103,6 @@ void MatrixController::run()
         switch (m_animation)
         {
         case none:
-            // give the processor some time to do other stuff when not animating
-            delay(50);
             break;
         case scroll_next:
             m_md.setTextEffect(PA_NO_EFFECT, PA_SCROLL_LEFT);
@@ -137,4 +135,5 @@ void MatrixController::run()
         }
         m_md.displayReset();
     }
+    setPeriod(m_animation == none ? c_idle_period_ms : c_frame_period_ms);
 }
@@ -10,7 +10,7 @@
 /**
  * @brief A class for controlling a 32x8 LED matrix display using the MD_Parola library.
  */
-class MatrixController final : BootProcess, Thread<>
+class MatrixController final : BootProcess, PeriodicThread<50>
 {
 public:
     /**
@@ -21,7 +21,7 @@ public:
      */
     explicit MatrixController(uint8_t cs_pin, auto&&... text_suppliers)
         : BootProcess("Matrix initialized"),
-          Thread({.name = "matrix loop", .priority = 2, .coreId = APP_CPU_NUM}),
+          PeriodicThread({.name = "matrix loop", .priority = 2, .coreId = APP_CPU_NUM}),
           m_md(MD_MAX72XX::FC16_HW, cs_pin, 4)
     {
         m_tabs.reserve(sizeof...(text_suppliers) + 1);
@@ -73,6 +73,8 @@ public:
      */
     void scrollTo(uint8_t index);
 
+    using PeriodicThread::stats;
+
     // delete copy constructor and assignment operator
 
     MatrixController(const MatrixController&) = delete;
@@ -81,7 +83,9 @@ public:
 private:
     void runBootProcess() override;
 
-    void run() override;
+    // runs once every frame period while scrolling and once every idle period otherwise;
+    // the scroll animation advances at most one frame per period
+    void tick() override;
 
     enum Animation
     {
@@ -95,6 +99,9 @@ private:
     };
 
     static constexpr uint8_t c_scroll_spacing{32};
+    static constexpr uint32_t c_frame_period_ms{10};
+    // a static tab changes its text at most once a second, so it is refreshed less often; the thread starts idle
+    static constexpr uint32_t c_idle_period_ms{50};
 
     MD_Parola m_md;
     Animation m_animation{none};
@@ -103,7 +110,7 @@ private:
     Tab* m_current_tab{nullptr};
     Tab* m_new_tab{nullptr};
     char m_buf[12]{};
-    Timer m_scroll_home_timer{};
+    Timer m_scroll_home_timer{"matrix home"};
     bool m_initialized{false};
 };
 
@@ -0,0 +1,309 @@
+#include "mp3_info.h"
+
+#include <algorithm>
+#include <memory>
+#include <new>
+
+
+static constexpr size_t c_id3v1_size = 128;
+// longest ID3v2 title frame read; titles are truncated to MP3_INFO_TITLE_SIZE anyway
+static constexpr size_t c_title_frame_max = 4 * MP3_INFO_TITLE_SIZE;
+// bytes of the first frame needed for reading a Xing/Info or VBRI header
+static constexpr size_t c_frame_head = 4 + 32 + 18;
+
+
+static uint32_t be16(const uint8_t* b) { return b[0] << 8 | b[1]; }
+static uint32_t be24(const uint8_t* b) { return b[0] << 16 | b[1] << 8 | b[2]; }
+static uint32_t be32(const uint8_t* b) { return static_cast<uint32_t>(b[0]) << 24 | be24(b + 1); }
+static uint32_t syncsafe(const uint8_t* b) { return (b[0] & 0x7F) << 21 | (b[1] & 0x7F) << 14 | (b[2] & 0x7F) << 7 | (b[3] & 0x7F); }
+
+static bool readAt(File& file, uint32_t position, uint8_t* buffer, size_t size)
+{
+    return file.seek(position) && file.read(buffer, size) == size;
+}
+
+
+/**
+ * Writer of a null-terminated UTF-8 string into a fixed buffer, dropping characters that don't fit
+ */
+class Utf8Writer
+{
+    char* m_buffer;
+    size_t m_size;
+    size_t m_length{};
+
+public:
+    Utf8Writer(char* buffer, size_t size) : m_buffer(buffer), m_size(size) { m_buffer[0] = '\0'; }
+
+    bool put(uint32_t code_point)
+    {
+        char encoded[4];
+        size_t length;
+        if (code_point < 0x80)
+        {
+            encoded[0] = static_cast<char>(code_point);
+            length = 1;
+        }
+        else if (code_point < 0x800)
+        {
+            encoded[0] = static_cast<char>(0xC0 | code_point >> 6);
+            encoded[1] = static_cast<char>(0x80 | (code_point & 0x3F));
+            length = 2;
+        }
+        else if (code_point < 0x10000)
+        {
+            encoded[0] = static_cast<char>(0xE0 | code_point >> 12);
+            encoded[1] = static_cast<char>(0x80 | (code_point >> 6 & 0x3F));
+            encoded[2] = static_cast<char>(0x80 | (code_point & 0x3F));
+            length = 3;
+        }
+        else
+        {
+            encoded[0] = static_cast<char>(0xF0 | code_point >> 18);
+            encoded[1] = static_cast<char>(0x80 | (code_point >> 12 & 0x3F));
+            encoded[2] = static_cast<char>(0x80 | (code_point >> 6 & 0x3F));
+            encoded[3] = static_cast<char>(0x80 | (code_point & 0x3F));
+            length = 4;
+        }
+
+        // a character is never split, so the truncated string stays valid UTF-8
+        if (m_length + length >= m_size)
+            return false;
+        memcpy(m_buffer + m_length, encoded, length);
+        m_length += length;
+        m_buffer[m_length] = '\0';
+        return true;
+    }
+};
+
+
+/**
+ * Decodes the contents of an ID3v2 text frame, whose first byte specifies the text encoding
+ */
+static void decodeText(const uint8_t* data, size_t size, char* title)
+{
+    Utf8Writer out{title, MP3_INFO_TITLE_SIZE};
+    if (size == 0)
+        return;
+
+    auto encoding = data[0];
+    auto* end = data + size;
+    auto* it = data + 1;
+    if (encoding == 0 /*ISO-8859-1*/ || encoding == 3 /*UTF-8*/)
+    {
+        // UTF-8 is copied byte-wise, so only the bytes of a truncated character are checked
+        for (; it < end && *it; ++it)
+        {
+            if (encoding == 3 && *it >= 0x80)
+            {
+                auto length = *it >= 0xF0 ? 4 : *it >= 0xE0 ? 3 : 2;
+                if (it + length > end)
+                    break;
+                uint32_t code_point = *it & (0x3F >> (length - 1));
+                for (int i = 1; i < length; ++i)
+                    code_point = code_point << 6 | (it[i] & 0x3F);
+                if (!out.put(code_point))
+                    break;
+                it += length - 1;
+            }
+            else if (!out.put(*it))
+            {
+                break;
+            }
+        }
+        return;
+    }
+
+    // UTF-16 with byte order mark (1) or big endian UTF-16 (2)
+    auto big_endian = encoding == 2;
+    if (encoding == 1 && end - it >= 2)
+    {
+        big_endian = it[0] == 0xFE && it[1] == 0xFF;
+        it += 2;
+    }
+    auto unit = [&](const uint8_t* at) -> uint32_t { return big_endian ? at[0] << 8 | at[1] : at[1] << 8 | at[0]; };
+    for (; end - it >= 2; it += 2)
+    {
+        auto code_point = unit(it);
+        if (code_point == 0)
+            break;
+        if (code_point >= 0xD800 && code_point < 0xDC00 && end - it >= 4)
+        {
+            it += 2;
+            code_point = 0x10000 + ((code_point - 0xD800) << 10) + (unit(it) - 0xDC00);
+        }
+        if (!out.put(code_point))
+            break;
+    }
+}
+
+/**
+ * Reads the title of an ID3v2 tag at the start of a file
+ * @return The offset of the data following the tag, i.e., 0 if the file has no tag
+ */
+static uint32_t readId3v2(File& file, char* title)
+{
+    uint8_t header[10];
+    if (!readAt(file, 0, header, sizeof(header)) || memcmp(header, "ID3", 3) != 0)
+        return 0;
+
+    auto version = header[3];
+    auto flags = header[5];
+    auto tag_end = 10 + syncsafe(header + 6);
+    // the footer flag adds a copy of the header at the end
+    auto data_start = tag_end + (flags & 0x10 ? 10 : 0);
+    // unsynchronised tags would have to be decoded before reading frames; they are rare, so only skipped
+    if (version < 2 || version > 4 || flags & 0x80)
+        return data_start;
+
+    uint32_t position = 10;
+    if (version >= 3 && flags & 0x40)
+    {
+        uint8_t size[4];
+        if (!readAt(file, position, size, sizeof(size)))
+            return data_start;
+        // the size of the extended header includes its size field for v2.4 only
+        auto extended = version == 4 ? syncsafe(size) : uint64_t{4} + be32(size);
+        if (extended > tag_end - position)
+            return data_start;
+        position += extended;
+    }
+
+    // ID3v2.2 uses shorter frame headers and three character frame ids
+    size_t header_size = version == 2 ? 6 : 10;
+    const char* title_id = version == 2 ? "TT2" : "TIT2";
+    uint8_t frame[10];
+    while (position + header_size <= tag_end && readAt(file, position, frame, header_size) && frame[0] != 0)
+    {
+        auto size = version == 2 ? be24(frame + 3) : version == 4 ? syncsafe(frame + 4) : be32(frame + 4);
+        // a frame exceeding the tag is corrupted, and skipping it could wrap the position around
+        if (size > tag_end - position - header_size)
+            break;
+        if (memcmp(frame, title_id, version == 2 ? 3 : 4) == 0)
+        {
+            // compressed or encrypted frames are skipped; a data length indicator precedes the text
+            auto skip = version == 4 ? (frame[9] & 0x0E ? UINT32_MAX : frame[9] & 0x01 ? 4 : 0) :
+                version == 3 ? (frame[9] & 0xC0 ? UINT32_MAX : 0) : 0;
+            if (skip < size)
+            {
+                uint8_t text[c_title_frame_max];
+                auto length = std::min<size_t>(size - skip, sizeof(text));
+                if (readAt(file, position + header_size + skip, text, length))
+                    decodeText(text, length, title);
+            }
+            break;
+        }
+        position += header_size + size;
+    }
+    return data_start;
+}
+
+
+/**
+ * Properties of an MPEG-1/2/2.5 Layer III frame
+ */
+struct FrameHeader
+{
+    uint32_t sample_rate;
+    uint32_t bitrate;
+    uint32_t samples;
+    uint32_t size;
+    // offset of a Xing/Info header from the frame start, following the side information
+    uint32_t xing_offset;
+
+    static bool parse(const uint8_t* h, FrameHeader& frame)
+    {
+        static constexpr uint16_t c_bitrates[2][15] = {
+            {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+            {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+        };
+        static constexpr uint32_t c_sample_rates[3] = {44100, 48000, 32000};
+
+        if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0)
+            return false;
+        auto version = h[1] >> 3 & 0x03;
+        auto layer = h[1] >> 1 & 0x03;
+        auto bitrate_index = h[2] >> 4;
+        auto rate_index = h[2] >> 2 & 0x03;
+        // version 1 is reserved, layer 1 denotes Layer III
+        if (version == 1 || layer != 1 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3)
+            return false;
+
+        auto mpeg1 = version == 3;
+        auto mono = (h[3] >> 6) == 3;
+        frame.bitrate = c_bitrates[mpeg1 ? 0 : 1][bitrate_index];
+        frame.sample_rate = c_sample_rates[rate_index] >> (mpeg1 ? 0 : version == 2 ? 1 : 2);
+        frame.samples = mpeg1 ? 1152 : 576;
+        frame.size = (mpeg1 ? 144000 : 72000) * frame.bitrate / frame.sample_rate + (h[2] >> 1 & 0x01);
+        frame.xing_offset = 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+        return true;
+    }
+};
+
+
+Mp3Info Mp3Info::read(File& file)
+{
+    Mp3Info info{};
+    auto audio_start = readId3v2(file, info.title);
+
+    size_t window = std::min<size_t>(MP3_INFO_SYNC_WINDOW + c_frame_head, file.size() - std::min<size_t>(audio_start, file.size()));
+    std::unique_ptr<uint8_t[]> buffer{new(std::nothrow) uint8_t[window]};
+    if (!buffer || window < c_frame_head || !readAt(file, audio_start, buffer.get(), window))
+        return info;
+
+    // a frame is only accepted if it is followed by another frame or by the end of the window,
+    // as the sync bits may also occur in leftover tag data
+    FrameHeader frame{};
+    size_t offset = 0;
+    for (; offset + c_frame_head <= window; ++offset)
+    {
+        FrameHeader next{};
+        if (FrameHeader::parse(buffer.get() + offset, frame) &&
+            (offset + frame.size + 4 > window || FrameHeader::parse(buffer.get() + offset + frame.size, next)))
+            break;
+    }
+    if (offset + c_frame_head > window)
+        return info;
+
+    // VBR files describe their frame count and size in the first frame
+    uint32_t frames = 0;
+    uint32_t bytes = 0;
+    auto* xing = buffer.get() + offset + frame.xing_offset;
+    auto* vbri = buffer.get() + offset + 4 + 32;
+    if (memcmp(xing, "Xing", 4) == 0 || memcmp(xing, "Info", 4) == 0)
+    {
+        auto flags = be32(xing + 4);
+        auto* field = xing + 8;
+        if (flags & 0x01)
+        {
+            frames = be32(field);
+            field += 4;
+        }
+        if (flags & 0x02)
+            bytes = be32(field);
+    }
+    else if (memcmp(vbri, "VBRI", 4) == 0)
+    {
+        bytes = be32(vbri + 10);
+        frames = be32(vbri + 14);
+    }
+
+    info.audio.sample_rate = frame.sample_rate;
+    if (frames)
+    {
+        info.audio.duration_ms = static_cast<uint64_t>(frames) * frame.samples * 1000 / frame.sample_rate;
+        info.audio.bitrate = bytes && info.audio.duration_ms ? static_cast<uint64_t>(bytes) * 8 / info.audio.duration_ms : frame.bitrate;
+    }
+    else
+    {
+        // constant bitrate: the audio data ends at the file end or at a trailing ID3v1 tag
+        uint64_t audio_size = file.size() - audio_start - offset;
+        uint8_t tag[3];
+        if (file.size() >= c_id3v1_size && readAt(file, file.size() - c_id3v1_size, tag, sizeof(tag)) &&
+            memcmp(tag, "TAG", 3) == 0)
+            audio_size -= std::min<uint64_t>(audio_size, c_id3v1_size);
+        info.audio.bitrate = frame.bitrate;
+        info.audio.duration_ms = audio_size * 8 / frame.bitrate;
+    }
+    return info;
+}
@@ -0,0 +1,41 @@
+#ifndef MP3_INFO_H
+#define MP3_INFO_H
+
+#include <FS.h>
+#include "sound_table.h"
+
+#ifndef MP3_INFO_TITLE_SIZE
+// buffer size for the title of a sound in bytes, including the terminator; longer titles are truncated
+#define MP3_INFO_TITLE_SIZE 96
+#endif
+
+#ifndef MP3_INFO_SYNC_WINDOW
+// bytes following the ID3v2 tag searched for the first MPEG audio frame
+#define MP3_INFO_SYNC_WINDOW 2048
+#endif
+
+
+/**
+ * Metadata of an MP3 file, read from its ID3v2 tag and the header of its first MPEG audio frame
+ *
+ * The duration of VBR files is taken from the Xing/Info or VBRI header following the first frame,
+ * the duration of CBR files is derived from the size of the audio data; only the file's head
+ * (and its last 128 bytes checking for an ID3v1 tag) are read, the audio data is never decoded
+ */
+struct Mp3Info
+{
+    //! The title of the ID3v2 tag (TIT2) encoded as UTF-8; empty if the file has no title
+    char title[MP3_INFO_TITLE_SIZE];
+    //! The audio properties; all zero if no MPEG audio frame was found
+    SoundTable::Metadata audio;
+
+    /**
+     * Reads the metadata of an MP3 file
+     * @param file The opened MP3 file; its position is changed
+     * @return The metadata read, with empty members for properties that could not be read
+     */
+    static Mp3Info read(File& file);
+};
+
+
+#endif //MP3_INFO_H
@@ -0,0 +1,167 @@
+#include "read_ahead_stream.h"
+
+#include <esp_heap_caps.h>
+#include <esp_memory_utils.h>
+#include <algorithm>
+#include "log.h"
+
+
+ReadAheadStream::ReadAheadStream() :
+    Thread({.name = "read ahead", .priority = 9}) {}
+
+ReadAheadStream::~ReadAheadStream()
+{
+    end();
+    if (m_buffer)
+        vStreamBufferDelete(m_buffer);
+    heap_caps_free(m_storage);
+    heap_caps_free(m_chunk);
+}
+
+bool ReadAheadStream::begin(Stream& source)
+{
+    end();
+    if (!allocate())
+        return false;
+
+    // the reader task is stopped, so the buffer can be reset
+    xStreamBufferReset(m_buffer);
+    m_peeked = -1;
+    m_primed = false;
+    m_underruns = 0;
+    m_wait_ms = 0;
+    m_min_level = READ_AHEAD_STREAM_SIZE;
+    m_bytes = 0;
+    m_eof = false;
+    m_active = true;
+    m_reading = true;
+    m_start.put(&source);
+    return true;
+}
+
+void ReadAheadStream::end()
+{
+    m_active = false;
+    if (m_reading.exchange(false))
+    {
+        m_end.put(true);
+        bool stopped;
+        m_stopped.take(stopped);
+    }
+}
+
+bool ReadAheadStream::ended() const
+{
+    return m_eof && m_peeked < 0 && (!m_buffer || xStreamBufferIsEmpty(m_buffer));
+}
+
+ReadAheadStream::Stats ReadAheadStream::stats() const
+{
+    return {m_underruns, m_wait_ms, m_min_level, m_bytes};
+}
+
+int ReadAheadStream::available()
+{
+    if (!m_buffer)
+        return 0;
+    auto buffered = xStreamBufferBytesAvailable(m_buffer) + (m_peeked >= 0 ? 1 : 0);
+    // an empty buffer of a source not yet ended is reported as readable, as a read waits for the reader task
+    return buffered > 0 || m_eof ? static_cast<int>(buffered) : 1;
+}
+
+int ReadAheadStream::read()
+{
+    uint8_t byte;
+    return readBytes(&byte, 1) == 1 ? byte : -1;
+}
+
+int ReadAheadStream::peek()
+{
+    if (m_peeked < 0)
+        m_peeked = read();
+    return m_peeked;
+}
+
+size_t ReadAheadStream::readBytes(uint8_t* buffer, size_t length)
+{
+    if (!m_buffer || length == 0)
+        return 0;
+
+    size_t count = 0;
+    if (m_peeked >= 0)
+    {
+        buffer[count++] = static_cast<uint8_t>(m_peeked);
+        m_peeked = -1;
+    }
+
+    auto level = xStreamBufferBytesAvailable(m_buffer);
+    m_min_level = std::min<uint32_t>(m_min_level, level);
+    count += xStreamBufferReceive(m_buffer, buffer + count, length - count, 0);
+    if (count < length && !(m_eof && xStreamBufferIsEmpty(m_buffer)))
+    {
+        // the reader task fell behind, which shows up as a gap in the playback if the output buffers run empty;
+        // the first read of a stream always waits for the first chunk, which is no underrun
+        if (m_primed)
+            ++m_underruns;
+        auto start = millis();
+        if (count == 0)
+            count = xStreamBufferReceive(m_buffer, buffer, length, pdMS_TO_TICKS(READ_AHEAD_STREAM_TIMEOUT));
+        if (m_primed)
+            m_wait_ms += millis() - start;
+    }
+    m_primed |= count > 0;
+    return count;
+}
+
+void ReadAheadStream::run()
+{
+    Stream* source;
+    m_start.take(source);
+
+    while (m_active)
+    {
+        auto length = source->readBytes(m_chunk, READ_AHEAD_STREAM_CHUNK_SIZE);
+        if (length == 0)
+        {
+            m_eof = true;
+            break;
+        }
+        m_bytes += length;
+
+        // blocks while the buffer is full; the timeout allows ending the stream in the meantime
+        for (size_t sent = 0; sent < length && m_active;)
+            sent += xStreamBufferSend(m_buffer, m_chunk + sent, length - sent, pdMS_TO_TICKS(100));
+    }
+
+    // wait for the stream being ended, so a new source is not started before the previous one was released
+    bool ended;
+    m_end.take(ended);
+    m_stopped.put(true);
+}
+
+bool ReadAheadStream::allocate()
+{
+    if (m_buffer)
+        return true;
+
+    // the ring buffer is only accessed by the CPU, so it may reside in PSRAM;
+    // the chunk buffer is read into by the SD driver, which needs internal memory for DMA transfers
+    m_storage = static_cast<uint8_t*>(heap_caps_malloc(READ_AHEAD_STREAM_SIZE + 1, MALLOC_CAP_SPIRAM));
+    if (!m_storage)
+        m_storage = static_cast<uint8_t*>(heap_caps_malloc(READ_AHEAD_STREAM_SIZE + 1, MALLOC_CAP_DEFAULT));
+    m_chunk = static_cast<uint8_t*>(heap_caps_aligned_alloc(4, READ_AHEAD_STREAM_CHUNK_SIZE, MALLOC_CAP_DMA));
+    if (!m_storage || !m_chunk)
+    {
+        LOG_E("Failed to allocate read ahead buffers");
+        heap_caps_free(m_storage);
+        heap_caps_free(m_chunk);
+        m_storage = m_chunk = nullptr;
+        return false;
+    }
+
+    // a trigger level of 1 lets a waiting read return as soon as any data arrived
+    m_buffer = xStreamBufferCreateStatic(READ_AHEAD_STREAM_SIZE, 1, m_storage, &m_buffer_struct);
+    LOG_D("Allocated read ahead buffer of %u bytes in %s", READ_AHEAD_STREAM_SIZE,
+          esp_ptr_external_ram(m_storage) ? "PSRAM" : "internal RAM");
+    return m_buffer != nullptr;
+}
@@ -0,0 +1,121 @@
+#ifndef READ_AHEAD_STREAM_H
+#define READ_AHEAD_STREAM_H
+
+#include <Arduino.h>
+#include <freertos/stream_buffer.h>
+#include "util/thread.hpp"
+#include "util/blocking_queue.hpp"
+#include <atomic>
+
+#ifndef READ_AHEAD_STREAM_SIZE
+// size of the ring buffer in bytes, allocated in PSRAM if available; 64 KiB hold about 4 s of 128 kbit/s MP3
+#define READ_AHEAD_STREAM_SIZE (64 * 1024)
+#endif
+
+#ifndef READ_AHEAD_STREAM_CHUNK_SIZE
+// bytes read from the source at once; a multiple of the SD card's sector size, so whole sectors are transferred
+#define READ_AHEAD_STREAM_CHUNK_SIZE 4096
+#endif
+
+#ifndef READ_AHEAD_STREAM_TIMEOUT
+// milliseconds a read waits for the reader task before returning no data; the source may still continue afterward
+#define READ_AHEAD_STREAM_TIMEOUT 500
+#endif
+
+#ifndef READ_AHEAD_STREAM_STACK_SIZE
+#define READ_AHEAD_STREAM_STACK_SIZE 3072
+#endif
+
+
+/**
+ * Stream prefetching the contents of a source stream into a ring buffer, which is filled by a separate reader task
+ *
+ * The reader task reads the source in large chunks and blocks while the ring buffer is full,
+ * so the reads of the consumer are served from memory and only wait for the source if the buffer ran empty;
+ * such underruns are counted, indicating a buffer too small to cover the contention of the source.
+ * The buffer is a FreeRTOS stream buffer, which supports a single reading and a single writing task
+ */
+class ReadAheadStream final : public Stream, Thread<READ_AHEAD_STREAM_STACK_SIZE>
+{
+public:
+    /**
+     * Statistics of the reads since the stream was started
+     */
+    struct Stats
+    {
+        //! Number of reads which found fewer bytes buffered than requested before the source ended
+        uint32_t underruns;
+        //! Total milliseconds reads waited for data
+        uint32_t wait_ms;
+        //! Lowest number of buffered bytes seen by a read
+        uint32_t min_level;
+        //! Bytes read from the source
+        uint32_t bytes;
+    };
+
+    ReadAheadStream();
+    ~ReadAheadStream() override;
+
+    /**
+     * Starts prefetching a source stream, discarding the data buffered from a previous source
+     * @param source The stream to read from; must stay valid until the stream is ended or restarted
+     * @return false if the buffers could not be allocated
+     */
+    bool begin(Stream& source);
+
+    /**
+     * Stops prefetching and waits for the reader task to release the source
+     */
+    void end();
+
+    /**
+     * Get whether the source ended and all of its data was read; a read returning no data before
+     * only timed out waiting for the reader task
+     */
+    [[nodiscard]] bool ended() const;
+
+    /**
+     * Get the statistics of the reads since the stream was started
+     */
+    [[nodiscard]] Stats stats() const;
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t readBytes(uint8_t* buffer, size_t length) override;
+    size_t readBytes(char* buffer, size_t length) override { return readBytes(reinterpret_cast<uint8_t*>(buffer), length); }
+    size_t write(uint8_t) override { return 0; }
+
+    // delete copy constructor and assignment operator
+
+    ReadAheadStream(const ReadAheadStream&) = delete;
+    ReadAheadStream& operator=(const ReadAheadStream&) = delete;
+
+private:
+    void run() override;
+    bool allocate();
+
+    StreamBufferHandle_t m_buffer{};
+    StaticStreamBuffer_t m_buffer_struct{};
+    uint8_t* m_storage{};
+    uint8_t* m_chunk{};
+    int m_peeked{-1};
+    bool m_primed{false};
+
+    ESPQueue<1, Stream*> m_start{};
+    // signals the reader task that the stream was ended, which it waits for after the source ended
+    ESPQueue<1, bool> m_end{};
+    ESPQueue<1, bool> m_stopped{};
+    std::atomic<bool> m_active{false};
+    std::atomic<bool> m_reading{false};
+    std::atomic<bool> m_eof{false};
+
+    // written by the consumer and the reader task, read by any task
+    std::atomic<uint32_t> m_underruns{};
+    std::atomic<uint32_t> m_wait_ms{};
+    std::atomic<uint32_t> m_min_level{};
+    std::atomic<uint32_t> m_bytes{};
+};
+
+
+#endif //READ_AHEAD_STREAM_H
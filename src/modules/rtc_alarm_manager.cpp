@@ -45,7 +45,7 @@ void RtcAlarmManager::setInternalFromExternal()
     // we temporarily set the system timezone to UTC
     set_timezone("UTC");
     timeval tv{.tv_sec = mktime(&tm)};
-    set_timezone(m_timezone->c_str());
+    set_timezone(m_timezone.read().c_str());
     settimeofday(&tv, nullptr);
 
     auto now = time(nullptr);
@@ -106,8 +106,8 @@ void RtcAlarmManager::runBootProcess()
         ::set_timezone(tz.c_str());
     };
     m_timezone.observe(set_timezone);
-    if (!m_timezone->isEmpty())
-        set_timezone(*m_timezone);
+    if (const auto tz = m_timezone.read(); !tz.isEmpty())
+        set_timezone(tz);
 
 
     set_internal_rtc_from_compile_datetime();
@@ -182,7 +182,7 @@ void RtcAlarmManager::runBootProcess()
         {
             m_rtc.alarmClearFlag(URTCLIB_ALARM_1);
 
-            if (*m_alarm_1.repeat)
+            if (m_alarm_1.repeat.read())
                 m_alarm_1.computeNextAndSet();
             else
                 m_alarm_1.enabled = false;
@@ -192,7 +192,7 @@ void RtcAlarmManager::runBootProcess()
         {
             m_rtc.alarmClearFlag(URTCLIB_ALARM_2);
 
-            if (*m_alarm_2.repeat)
+            if (m_alarm_2.repeat.read())
                 m_alarm_2.computeNextAndSet();
             else
                 m_alarm_2.enabled = false;
@@ -204,7 +204,9 @@ void RtcAlarmManager::runBootProcess()
 
     // stop alarm after 3 minutes
     m_deactivate_timer.once(1800, [] { ALARM_EVENT << DEACTIVATE; });
-    // update internal RTC from external every hour
+    // update internal RTC from external every hour;
+    // deferred as it performs I2C transfers which must not block the timer service
+    m_update_timer.setDeferred(true);
     m_update_timer.always(3600, [this] { setInternalFromExternal(); });
 
 
@@ -229,9 +231,8 @@ void RtcAlarmManager::Alarm::setIn8h()
     tm tm{};
     gmtime_r(&t, &tm);
 
-    // we edit the NVVs, which would trigger recomputation with every assignment,
-    // so we temporarily halt recomputing the next ring time
-    m_no_compute = true;
+    // batch the edits, so the next ring time is only computed and set once
+    NVS::Transaction transaction;
 
     hour = tm.tm_hour;
     minute = tm.tm_min;
@@ -243,8 +244,8 @@ void RtcAlarmManager::Alarm::setIn8h()
 
     enabled = true;
 
-    m_no_compute = false;
-    computeNextAndSet();
+    // the alarm must be set even if no value changed
+    update();
 }
 
 time_t RtcAlarmManager::Alarm::next() const
@@ -252,47 +253,57 @@ time_t RtcAlarmManager::Alarm::next() const
     return m_next;
 }
 
-RtcAlarmManager::Alarm::Alarm(const char* key_hour, const char* key_minute, const char* key_repeat,
-                              const char* key_sound, const char* key_enabled, RtcAlarmManager& mgr,
-                              uint8_t id): hour(key_hour),
-                                           minute(key_minute),
-                                           repeat(key_repeat),
-                                           sound(key_sound),
-                                           enabled(key_enabled),
-                                           m_mgr(mgr),
-                                           m_id(id)
+RtcAlarmManager::Alarm::Alarm(const char* key, RtcAlarmManager& mgr, uint8_t id): m_data(key),
+                                                                                 m_mgr(mgr),
+                                                                                 m_id(id)
 {
-    hour.observe([this](auto)
+    // alarms were stored as five entries each before, which are moved into the blob once
+    m_data.migrateFrom([number = (id >> 7) + 1](Data& data)
     {
-        if (!m_no_compute)
+        bool found = false;
+        auto take = [&](const char* name, auto& member)
         {
-            enabled = true;
-            computeNextAndSet();
-        }
-    });
-    minute.observe([this](auto)
-    {
-        if (!m_no_compute)
-        {
-            enabled = true;
-            computeNextAndSet();
-        }
+            char key[NVS_KEY_NAME_MAX_SIZE];
+            snprintf(key, sizeof(key), "a%d%s", number, name);
+            if (auto value = NVS::takeLegacy(key))
+            {
+                member = *value;
+                found = true;
+            }
+        };
+        take("hour", data.hour);
+        take("minute", data.minute);
+        take("repeat", data.repeat);
+        take("sound", data.sound);
+        take("enabled", data.enabled);
+        return found;
     });
-    repeat.observe([this](auto)
+
+    // changing the alarm time enables the alarm
+    auto&& reschedule = [this](auto)
     {
-        if (!m_no_compute)
-        {
-            enabled = true;
-            computeNextAndSet();
-        }
-    });
-    enabled.observe([this](auto)
+        enabled = true;
+        update();
+    };
+    hour.observe(reschedule);
+    minute.observe(reschedule);
+    repeat.observe(reschedule);
+    enabled.observe([this](auto) { update(); });
+    // the ring time does not depend on the sound, so the RTC is left as it is
+    sound.observe([this](auto)
     {
-        if (!m_no_compute)
-            set();
+        if (enabled.read())
+            ALARM_EVENT << SOUND_CHANGED << static_cast<uint8_t>(m_id >> 7);
     });
 }
 
+// compute the next ring time and set the alarm once the current NVS transaction ends,
+// so that changing multiple values results in only a single RTC update
+void RtcAlarmManager::Alarm::update()
+{
+    NVS::defer(this, [this] { computeNextAndSet(); });
+}
+
 // set the RTC to trigger its alarm at the given time
 void RtcAlarmManager::Alarm::setAt(const time_t& t) const
 {
@@ -311,17 +322,25 @@ void RtcAlarmManager::Alarm::setAt(const time_t& t) const
 // or disable the RTC's alarm if the alarm is disabled
 void RtcAlarmManager::Alarm::set()
 {
-    if (*enabled)
+    if (enabled.read())
+    {
         setAt(m_next);
+        ALARM_EVENT << ALARM_SET << static_cast<uint8_t>(m_id >> 7);
+    }
     else
         m_mgr.m_rtc.alarmDisable(m_id);
 }
 
-// if computation is allowed and the alarm is enabled,
-// compute the next ring time and set the alarm
+// if the alarm is enabled, compute the next ring time and set the alarm,
+// otherwise disable the RTC's alarm
 void RtcAlarmManager::Alarm::computeNextAndSet()
 {
-    if (m_no_compute || !*enabled) return;
+    const auto data = m_data.read();
+    if (!data.enabled)
+    {
+        set();
+        return;
+    }
 
     // get the current time and convert it to a tm value
     auto now = time(nullptr);
@@ -331,15 +350,15 @@ void RtcAlarmManager::Alarm::computeNextAndSet()
     int days_increment = 0;
 
     // if the current time is already in the past, add one day
-    if (*hour * 3600 + *minute * 60 <= tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec)
+    if (data.hour * 3600 + data.minute * 60 <= tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec)
         ++days_increment;
 
     // if the alarm is repeating, find the next weekday the alarm will repeat at
-    while (*repeat && !(*repeat & 1 << ((tm.tm_wday + days_increment) % 7)))
+    while (data.repeat && !(data.repeat & 1 << ((tm.tm_wday + days_increment) % 7)))
         ++days_increment;
 
-    tm.tm_hour = *hour;
-    tm.tm_min = *minute;
+    tm.tm_hour = data.hour;
+    tm.tm_min = data.minute;
     tm.tm_sec = 0;
     m_next = mktime(&tm) + days_increment * 86400LL;
 
@@ -67,29 +67,48 @@ private:
     /**
      * Alarm class storing the alarm data and being responsible for setting the alarm
      */
-    class [[gnu::packed]] Alarm
+    class Alarm
     {
+        /**
+         * The persisted alarm data, stored as a single NVS entry
+         */
+        struct Data
+        {
+            // increment when the meaning of the members changes to reset stored alarms
+            static constexpr uint16_t nvs_version = 2;
+
+            uint8_t hour;
+            uint8_t minute;
+            uint8_t repeat;
+            uint32_t sound;
+            bool enabled;
+
+            bool operator==(const Data&) const = default;
+        };
+
+        NVV<Data> m_data;
+
     public:
         /**
          * The alarm hour; changing the value will set the alarm
          */
-        NVV<uint8_t> hour;
+        NVV<Data>::Field<uint8_t> hour{m_data, &Data::hour};
         /**
          * The alarm minute; changing the value will set the alarm
          */
-        NVV<uint8_t> minute;
+        NVV<Data>::Field<uint8_t> minute{m_data, &Data::minute};
         /**
          * The days of the week the alarm should repeat at as a bitmask [0: sunday, ..., 6: saturday]
          */
-        NVV<uint8_t> repeat;
+        NVV<Data>::Field<uint8_t> repeat{m_data, &Data::repeat};
         /**
          * The sound number to be played when this alarm triggers
          */
-        NVV<uint8_t> sound;
+        NVV<Data>::Field<uint32_t> sound{m_data, &Data::sound};
         /**
          * Controls whether the alarm is enabled; changing the value will either set or disable the alarm
          */
-        NVV<bool> enabled;
+        NVV<Data>::Field<bool> enabled{m_data, &Data::enabled};
 
         /**
          * Set the alarm time to trigger in 8 hours from now
@@ -105,42 +124,22 @@ private:
     private:
         friend class RtcAlarmManager;
 
-        Alarm(const char* key_hour,
-              const char* key_minute,
-              const char* key_repeat,
-              const char* key_sound,
-              const char* key_enabled,
-              RtcAlarmManager& mgr,
-              uint8_t id);
+        Alarm(const char* key, RtcAlarmManager& mgr, uint8_t id);
         void setAt(const time_t& t) const;
         void set();
         void computeNextAndSet();
+        void update();
 
         RtcAlarmManager& m_mgr;
         time_t m_next{};
         uint8_t m_id;
-        bool m_no_compute = false;
     };
 
     uRTCLib m_rtc;
-    Alarm m_alarm_1{
-        "a1hour",
-        "a1minute",
-        "a1repeat",
-        "a1sound",
-        "a1enabled",
-        *this, URTCLIB_ALARM_1
-    };
-    Alarm m_alarm_2{
-        "a2hour",
-        "a2minute",
-        "a2repeat",
-        "a2sound",
-        "a2enabled",
-        *this, URTCLIB_ALARM_2
-    };
-    Timer m_update_timer;
-    Timer m_deactivate_timer;
+    Alarm m_alarm_1{"alarm1", *this, URTCLIB_ALARM_1};
+    Alarm m_alarm_2{"alarm2", *this, URTCLIB_ALARM_2};
+    Timer m_update_timer{"rtc update"};
+    Timer m_deactivate_timer{"alarm deactivate"};
     NVV<String> m_timezone{"timezone", "UTC"};
 };
 
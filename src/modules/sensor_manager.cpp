@@ -5,7 +5,7 @@
 
 
 SensorManager::SensorManager(uint8_t ldr_pin)
-    : BootProcess("Sensors initialized"), Thread({.name = "sensors"}),
+    : BootProcess("Sensors initialized"), PeriodicThread({.name = "sensors"}),
       m_ldr_pin(ldr_pin) {}
 
 float SensorManager::temperature() const { return m_temperature; }
@@ -30,7 +30,7 @@ void SensorManager::runBootProcess()
 #endif
 }
 
-void SensorManager::run()
+void SensorManager::tick()
 {
     m_light << static_cast<float>(analogRead(m_ldr_pin));
     SENSOR_EVENT << LIGHT << light();
@@ -57,6 +57,4 @@ void SensorManager::run()
         last = millis();
     }
 #endif
-
-    delay(50);
 }
@@ -11,11 +11,13 @@
  * Class for managing external temperatur, humidity and light sensors,
  * averaging the values and emitting events when new readings are available
  */
-class SensorManager final : BootProcess, Thread<>
+class SensorManager final : BootProcess, PeriodicThread<50>
 {
 public:
     explicit SensorManager(uint8_t ldr_pin);
 
+    using PeriodicThread::stats;
+
     /**
      * Get the current average temperature in °C
      */
@@ -33,7 +35,7 @@ public:
 
 private:
     void runBootProcess() override;
-    void run() override;
+    void tick() override;
 
     uint8_t m_ldr_pin;
     AveragingValue<float, 32> m_temperature{};
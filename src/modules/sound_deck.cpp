@@ -0,0 +1,115 @@
+#include "sound_deck.h"
+
+#include <esp_random.h>
+#include <algorithm>
+#include "log.h"
+
+
+/**
+ * Gets a new non-zero seed, as 0 marks a deck that was not shuffled yet
+ */
+static uint32_t newSeed()
+{
+    uint32_t seed;
+    do seed = esp_random();
+    while (seed == 0);
+    return seed;
+}
+
+/**
+ * Advances a xorshift32 generator; reproducible from its seed, unlike the hardware random number generator
+ * @param state The generator state; must not be 0
+ * @return The next random number
+ */
+static uint32_t xorshift32(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+
+SoundDeck::SoundDeck(const char* key) :
+    m_state(key) {}
+
+std::optional<uint32_t> SoundDeck::draw(const SoundTable& sounds)
+{
+    if (!peek(sounds))
+        return std::nullopt;
+
+    auto state = m_state.read();
+    state.last = m_cards[state.cursor++];
+    m_state = state;
+    return state.last;
+}
+
+std::optional<uint32_t> SoundDeck::peek(const SoundTable& sounds)
+{
+    if (!m_valid)
+        build(sounds);
+    if (m_cards.empty())
+        return std::nullopt;
+
+    auto state = m_state.read();
+    if (state.cursor >= m_cards.size())
+    {
+        state.seed = newSeed();
+        state.cursor = 0;
+        state.previous = state.last;
+        shuffle(state.seed, state.previous);
+        m_state = state;
+    }
+    return m_cards[state.cursor];
+}
+
+void SoundDeck::build(const SoundTable& sounds)
+{
+    m_cards.clear();
+    m_cards.reserve(sounds.size());
+    // FNV-1a over the bytes of the eligible numbers, which are sorted as the table rows are
+    uint32_t hash = 2166136261u;
+    for (size_t row = 0; row < sounds.size(); ++row)
+    {
+        if (sounds.allowRandom(row))
+        {
+            auto number = sounds.number(row);
+            m_cards.push_back(number);
+            for (int shift = 0; shift < 32; shift += 8)
+                hash = (hash ^ ((number >> shift) & 0xFF)) * 16777619u;
+        }
+    }
+    m_valid = true;
+
+    // restore the persisted round if it was shuffled from the same sounds, otherwise start a new round
+    auto state = m_state.read();
+    if (state.seed == 0 || state.hash != hash || state.cursor > m_cards.size())
+    {
+        state.seed = newSeed();
+        state.hash = hash;
+        state.cursor = 0;
+        state.previous = state.last;
+        m_state = state;
+    }
+    else
+    {
+        LOG_D("Restored sound deck at card %lu of %u", state.cursor, m_cards.size());
+    }
+    shuffle(state.seed, state.previous);
+}
+
+void SoundDeck::shuffle(uint32_t seed, uint32_t last)
+{
+    // each round is shuffled from the same order, so it can be reproduced from its seed
+    std::ranges::sort(m_cards);
+    for (auto i = m_cards.size(); i > 1; --i)
+    {
+        std::swap(m_cards[i - 1], m_cards[xorshift32(seed) % i]);
+    }
+
+    // don't play the sound drawn last twice in a row
+    if (m_cards.size() > 1 && m_cards.front() == last)
+    {
+        std::swap(m_cards.front(), m_cards[1 + xorshift32(seed) % (m_cards.size() - 1)]);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef SOUND_DECK_H
+#define SOUND_DECK_H
+
+#include "sound_table.h"
+#include "util/nvs.hpp"
+#include <optional>
+#include <vector>
+
+
+/**
+ * Shuffled deck of the sounds eligible for random selection, yielding every eligible sound once per round
+ *
+ * The deck is shuffled using Fisher–Yates with a seeded generator, so only the seed, the position
+ * and the last drawn sound need to be persisted for restoring the deck after a reboot;
+ * they are stored as a single NVS value. Drawing takes constant time and does not allocate,
+ * except for reshuffling after the last card, which also ensures the new round
+ * does not start with the sound drawn last. Changing the eligible sounds starts a new round
+ */
+class SoundDeck
+{
+public:
+    /**
+     * Constructor
+     * @param key The NVS key of the deck state; must be 15 characters or fewer
+     */
+    explicit SoundDeck(const char* key);
+
+    /**
+     * Marks the deck to be rebuilt from the sound table before the next draw;
+     * must be called whenever sounds are added or their eligibility for random selection changes
+     */
+    void invalidate() { m_valid = false; }
+
+    /**
+     * Draws the next sound from the deck
+     * @param sounds The sound table to build the deck from if it was invalidated
+     * @return The number of the drawn sound or an empty optional if no sound is eligible
+     */
+    std::optional<uint32_t> draw(const SoundTable& sounds);
+
+    /**
+     * Gets the sound the next draw yields without drawing it; after the last card, the next round is shuffled
+     * @param sounds The sound table to build the deck from if it was invalidated
+     * @return The number of the next sound or an empty optional if no sound is eligible
+     */
+    std::optional<uint32_t> peek(const SoundTable& sounds);
+
+private:
+    struct State
+    {
+        static constexpr uint16_t nvs_version = 2;
+
+        //! The seed of the current round's shuffle; 0 if no deck was shuffled yet
+        uint32_t seed;
+        //! Hash of the eligible sounds the current round was shuffled from
+        uint32_t hash;
+        //! The position of the next card
+        uint32_t cursor;
+        //! The number of the sound drawn last
+        uint32_t last;
+        //! The number of the sound drawn last before the current round, which must not start the round
+        uint32_t previous;
+
+        bool operator==(const State&) const = default;
+    };
+
+    void build(const SoundTable& sounds);
+    void shuffle(uint32_t seed, uint32_t last);
+
+    // the numbers of the eligible sounds in the order of the current round
+    std::vector<uint32_t> m_cards{};
+    bool m_valid{false};
+    NVV<State> m_state;
+};
+
+
+#endif //SOUND_DECK_H
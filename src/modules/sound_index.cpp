@@ -0,0 +1,176 @@
+#include "sound_index.h"
+
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cinttypes>
+#include <limits>
+#include <vector>
+#include "log.h"
+#include "util/atomic_file.hpp"
+
+
+static constexpr char c_magic[4] = {'S', 'I', 'D', 'X'};
+
+
+bool SoundIndex::write(const char* path, const SoundTable& sounds, FS& fs)
+{
+    auto start = esp_timer_get_time();
+
+    // offset 0 holds the empty string shared by all empty strings, as in the arena of the table
+    size_t pool_size = 1;
+    auto length = [](const char* str) { return *str ? strlen(str) + 1 : 0; };
+    for (auto sound : sounds)
+        pool_size += length(sound.path) + length(sound.name) + length(sound.title);
+
+    // assemble the whole file in memory, so it is written with a single call;
+    // the rows of the table are sorted by number, so the file does not depend on the order of changes
+    std::vector<uint8_t> image(sizeof(Header) + sounds.size() * sizeof(Entry) + pool_size);
+    auto* entries = reinterpret_cast<Entry*>(image.data() + sizeof(Header));
+    auto* pool = reinterpret_cast<char*>(entries + sounds.size());
+    pool[0] = '\0';
+    uint32_t offset = 1;
+    auto add = [&](const char* str) -> uint32_t
+    {
+        if (!*str)
+            return 0;
+        auto at = offset;
+        auto size = strlen(str) + 1;
+        memcpy(pool + offset, str, size);
+        offset += size;
+        return at;
+    };
+    size_t i = 0;
+    for (auto sound : sounds)
+    {
+        entries[i++] = {
+            .number = sound.number,
+            .flags = static_cast<uint8_t>(sound.allow_random ? c_flag_allow_random : 0),
+            .reserved = {},
+            .path = add(sound.path),
+            .name = add(sound.name),
+            .title = add(sound.title),
+            .duration_ms = sound.metadata.duration_ms,
+            .sample_rate = sound.metadata.sample_rate,
+            .bitrate = sound.metadata.bitrate,
+            .fingerprint = sound.metadata.fingerprint,
+        };
+    }
+
+    Header header{
+        .version = c_version,
+        .entry_size = sizeof(Entry),
+        .count = static_cast<uint32_t>(sounds.size()),
+        .pool_size = static_cast<uint32_t>(pool_size),
+        .crc = esp_rom_crc32_le(0, image.data() + sizeof(Header), image.size() - sizeof(Header)),
+    };
+    memcpy(header.magic, c_magic, sizeof(c_magic));
+    memcpy(image.data(), &header, sizeof(header));
+
+    auto ok = atomic_file::replace(fs, path, [&](File& file)
+    {
+        return file.write(image.data(), image.size()) == image.size();
+    });
+    if (ok)
+    {
+        LOG_D("Wrote index of %u sounds (%u bytes) in %lld us",
+              sounds.size(), image.size(), esp_timer_get_time() - start);
+    }
+    return ok;
+}
+
+bool SoundIndex::load(const char* path, SoundTable& sounds, FS& fs)
+{
+    atomic_file::recover(fs, path);
+    auto file = fs.open(path, FILE_READ);
+    if (!file)
+        return false;
+
+    Header header{};
+    if (file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, c_magic, sizeof(c_magic)) != 0 ||
+        header.version != c_version || header.entry_size != sizeof(Entry))
+    {
+        LOG_W("Sound index %s has an unknown format or version", path);
+        return false;
+    }
+
+    // computed in 64 bits, so a corrupted header can't wrap the size around to the file size
+    auto expected = static_cast<uint64_t>(header.count) * sizeof(Entry) + header.pool_size;
+    if (expected > file.size() || file.size() != sizeof(Header) + expected)
+    {
+        LOG_W("Sound index %s has an unexpected size", path);
+        return false;
+    }
+    // every offset must be addressable by the table
+    if (header.pool_size == 0 || header.pool_size - 1 > std::numeric_limits<SoundTable::offset_t>::max())
+    {
+        LOG_W("Sound index %s has an invalid string pool", path);
+        return false;
+    }
+
+    auto fail = [&](const char* reason)
+    {
+        LOG_W("Sound index %s %s", path, reason);
+        sounds.clear();
+        return false;
+    };
+
+    sounds.m_rows.clear();
+    sounds.m_rows.reserve(header.count);
+    sounds.m_arena_size = 0;
+    sounds.m_garbage = 0;
+    if (!sounds.grow(header.pool_size))
+    {
+        sounds.clear();
+        LOG_E("Failed to allocate %" PRIu32 " bytes for the sounds of index %s", header.pool_size, path);
+        return false;
+    }
+
+    // the entries are converted to rows in chunks, so no buffer for the whole entry table is needed
+    uint32_t crc = 0;
+    Entry chunk[SOUND_INDEX_LOAD_CHUNK];
+    for (uint32_t read = 0; read < header.count;)
+    {
+        auto n = std::min<uint32_t>(header.count - read, SOUND_INDEX_LOAD_CHUNK);
+        auto bytes = n * sizeof(Entry);
+        if (file.read(reinterpret_cast<uint8_t*>(chunk), bytes) != bytes)
+            return fail("could not be read");
+        crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t*>(chunk), bytes);
+
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            const auto& entry = chunk[i];
+            // the rows are searched by binary search, so the numbers must be strictly ascending
+            if (entry.path >= header.pool_size || entry.name >= header.pool_size || entry.title >= header.pool_size ||
+                (!sounds.m_rows.empty() && entry.number <= sounds.m_rows.back().number))
+                return fail("contains invalid entries");
+
+            sounds.m_rows.push_back({
+                .number = entry.number,
+                .path = static_cast<SoundTable::offset_t>(entry.path),
+                .name = static_cast<SoundTable::offset_t>(entry.name),
+                .title = static_cast<SoundTable::offset_t>(entry.title),
+                .metadata = {entry.duration_ms, entry.sample_rate, entry.bitrate, entry.fingerprint},
+                .flags = static_cast<uint8_t>(entry.flags & c_flag_allow_random ? SoundTable::c_allow_random : 0),
+            });
+        }
+        read += n;
+    }
+
+    // the pool becomes the arena of the table as it is
+    auto* pool = sounds.m_arena;
+    if (file.read(reinterpret_cast<uint8_t*>(pool), header.pool_size) != header.pool_size)
+        return fail("could not be read");
+    file.close();
+    crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t*>(pool), header.pool_size);
+
+    if (crc != header.crc)
+        return fail("is corrupted");
+    // the shared empty string and the last string of the pool must be terminated
+    if (pool[0] != '\0' || pool[header.pool_size - 1] != '\0')
+        return fail("has an invalid string pool");
+
+    sounds.m_arena_size = header.pool_size;
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef SOUND_INDEX_H
+#define SOUND_INDEX_H
+
+#include <FS.h>
+#include <SD.h>
+#include <cstddef>
+#include "sound_table.h"
+
+#ifndef SOUND_INDEX_LOAD_CHUNK
+// number of entries read at once when loading an index
+#define SOUND_INDEX_LOAD_CHUNK 16
+#endif
+
+
+/**
+ * Versioned binary index of the sound collection, laid out like a SoundTable,
+ * so it is read straight into a table without parsing or an intermediate copy of the file
+ *
+ * File layout (little endian):
+ *  - header: magic "SIDX", version, entry size, entry count, string pool size and a CRC32 of the remaining contents
+ *  - entry table: one fixed-size entry per sound, sorted by number, holding its number, flags,
+ *    the pool offsets of its strings and the audio properties of its file
+ *  - string pool: the null-terminated paths, names and titles of all sounds, starting with the empty string,
+ *    which all empty strings refer to; the pool becomes the string arena of the table
+ *
+ * Only the current version is loaded; an index of another version is replaced by the next scan
+ */
+class SoundIndex
+{
+public:
+    static constexpr uint16_t c_version = 4;
+
+    /**
+     * Writes the index of the given sounds, replacing the file atomically
+     * @param path The path of the index file
+     * @param sounds The sounds to index
+     * @param fs The filesystem to write the file to
+     * @return true if the file was written
+     */
+    static bool write(const char* path, const SoundTable& sounds, FS& fs = SD);
+
+    /**
+     * Reads and validates an index file into a table; the entries are converted to rows in chunks
+     * and the string pool is read directly into the table's arena
+     * @param path The path of the index file
+     * @param sounds The table to replace the contents of; cleared if the file is invalid
+     * @param fs The filesystem to read the file from
+     * @return true if the file exists and is a valid index of the current version
+     */
+    static bool load(const char* path, SoundTable& sounds, FS& fs = SD);
+
+private:
+    static constexpr uint8_t c_flag_allow_random = 0x01;
+
+    struct Header
+    {
+        char magic[4];
+        uint16_t version;
+        uint16_t entry_size;
+        uint32_t count;
+        uint32_t pool_size;
+        uint32_t crc;
+    };
+
+    struct Entry
+    {
+        uint32_t number;
+        uint8_t flags;
+        uint8_t reserved[3];
+        uint32_t path;
+        uint32_t name;
+        uint32_t title;
+        uint32_t duration_ms;
+        uint16_t sample_rate;
+        uint16_t bitrate;
+        uint32_t fingerprint;
+    };
+};
+
+
+#endif //SOUND_INDEX_H
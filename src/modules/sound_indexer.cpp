@@ -0,0 +1,337 @@
+#include "sound_indexer.h"
+
+#include <SD.h>
+#include <dirent.h>
+#include <esp_rom_crc.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "event_definitions.h"
+#include "log.h"
+#include "mp3_info.h"
+#include "sound_manager.h"
+#include "util/atomic_file.hpp"
+
+
+static constexpr uint32_t c_fnv_offset = 2166136261u;
+
+/**
+ * Continues an FNV-1a hash with the given bytes
+ */
+static uint32_t fnv1a(const void* data, size_t size, uint32_t hash = c_fnv_offset)
+{
+    for (auto* byte = static_cast<const uint8_t*>(data); size--; ++byte)
+        hash = (hash ^ *byte) * 16777619u;
+    return hash;
+}
+
+static uint32_t fnv1a(const char* str, uint32_t hash = c_fnv_offset)
+{
+    return fnv1a(str, strlen(str), hash);
+}
+
+
+/**
+ * Header of the scan state and fingerprint files, which are only used if their contents match it
+ */
+struct StateHeader
+{
+    char magic[4];
+    //! The size of the contents following the header
+    uint32_t size;
+    //! CRC32 of the contents
+    uint32_t crc;
+};
+
+static constexpr char c_state_magic[4] = {'S', 'S', 'C', 'N'};
+static constexpr char c_dirs_magic[4] = {'S', 'D', 'I', 'R'};
+
+/**
+ * Writes the header followed by the contents of a state file
+ */
+static bool write_state(File& file, const char (&magic)[4], const std::vector<uint8_t>& contents)
+{
+    StateHeader header{
+        .magic = {},
+        .size = static_cast<uint32_t>(contents.size()),
+        .crc = esp_rom_crc32_le(0, contents.data(), contents.size()),
+    };
+    memcpy(header.magic, magic, sizeof(magic));
+    return file.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header)) == sizeof(header) &&
+        file.write(contents.data(), contents.size()) == contents.size();
+}
+
+/**
+ * Reads the contents of a state file, validating them against its header
+ * @return false if the file is truncated or its contents don't match the header
+ */
+static bool read_state(File& file, const char (&magic)[4], std::vector<uint8_t>& contents)
+{
+    StateHeader header{};
+    if (file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, magic, sizeof(magic)) != 0 || file.size() != sizeof(header) + header.size)
+        return false;
+
+    contents.resize(header.size);
+    return file.read(contents.data(), contents.size()) == contents.size() &&
+        esp_rom_crc32_le(0, contents.data(), contents.size()) == header.crc;
+}
+
+
+SoundIndexer::SoundIndexer(SoundManager& sounds, const String& index_file):
+    Thread({.name = "sound indexer", .priority = tskIDLE_PRIORITY + 1}),
+    m_sounds(sounds),
+    m_state_file(index_file + ".scan"),
+    m_dirs_file(index_file + ".dirs") {}
+
+void SoundIndexer::begin()
+{
+    AUDIO_EVENT >> PLAYBACK_STARTED >> [this](auto) { m_paused = true; };
+    AUDIO_EVENT >> PLAYBACK_STOPPED >> [this](auto) { m_paused = false; };
+
+    atomic_file::recover(SD, m_dirs_file.c_str());
+    auto file = SD.open(m_dirs_file, FILE_READ);
+    if (!file)
+        return;
+
+    // the file holds the path hash and fingerprint of each directory, sorted by path hash
+    std::vector<uint8_t> contents{};
+    auto valid = read_state(file, c_dirs_magic, contents) && contents.size() % (2 * sizeof(uint32_t)) == 0;
+    file.close();
+    if (valid)
+    {
+        m_dirs.resize(contents.size() / (2 * sizeof(uint32_t)));
+        const auto* pos = contents.data();
+        for (auto& dir : m_dirs)
+        {
+            memcpy(&dir.path, pos, sizeof(dir.path));
+            memcpy(&dir.fingerprint, pos + sizeof(dir.path), sizeof(dir.fingerprint));
+            pos += sizeof(dir.path) + sizeof(dir.fingerprint);
+            dir.visited = false;
+        }
+        valid = std::ranges::is_sorted(m_dirs, {}, &DirPrint::path);
+    }
+    if (!valid)
+    {
+        // without fingerprints, every directory counts as changed, so the next scan reads all sounds
+        LOG_W("Directory fingerprints in %s are invalid, next scan reads all sounds", m_dirs_file.c_str());
+        m_dirs.clear();
+    }
+}
+
+void SoundIndexer::start()
+{
+    if (!m_running.exchange(true))
+        m_trigger.put(Scan::full);
+}
+
+void SoundIndexer::rescan()
+{
+    if (!m_running.exchange(true))
+        m_trigger.put(Scan::changed);
+}
+
+bool SoundIndexer::resume()
+{
+    // the pending directories belong to the indexer task while a scan is running
+    if (m_running.exchange(true))
+        return false;
+
+    atomic_file::recover(SD, m_state_file.c_str());
+    m_pending.clear();
+    if (auto file = SD.open(m_state_file, FILE_READ))
+    {
+        // the file holds the directories still to be scanned, each terminated by a line break
+        std::vector<uint8_t> contents{};
+        auto valid = read_state(file, c_state_magic, contents);
+        file.close();
+        if (!valid)
+        {
+            // the directories left to scan are unknown, so the interrupted scan is restarted
+            LOG_W("Sound scan state in %s is invalid, restarting the scan", m_state_file.c_str());
+            m_trigger.put(Scan::full);
+            return true;
+        }
+
+        for (auto it = contents.begin(); it != contents.end();)
+        {
+            auto end = std::find(it, contents.end(), '\n');
+            if (end != it)
+                m_pending.emplace_back(reinterpret_cast<const char*>(&*it), static_cast<unsigned int>(end - it));
+            it = end == contents.end() ? end : end + 1;
+        }
+    }
+
+    if (m_pending.empty())
+    {
+        m_running = false;
+        return false;
+    }
+
+    LOG_I("Resuming sound scan with %u directories left", m_pending.size());
+    m_trigger.put(Scan::resumed);
+    return true;
+}
+
+void SoundIndexer::run()
+{
+    Scan kind;
+    m_trigger.take(kind);
+
+    auto start = esp_timer_get_time();
+    uint32_t found = 0;
+    uint32_t removed = 0;
+    m_entries = 0;
+    if (kind != Scan::resumed)
+    {
+        // without fingerprints, every directory counts as changed
+        if (kind == Scan::full)
+            m_dirs.clear();
+        for (auto& dir : m_dirs)
+            dir.visited = false;
+        m_pending = {"/"};
+        // the state file is written by this task, so the caller doesn't wait for the SD card
+        checkpoint();
+    }
+    auto last_checkpoint = esp_timer_get_time();
+
+    while (!m_pending.empty())
+    {
+        auto path = std::move(m_pending.back());
+        m_pending.pop_back();
+        scan(path, found, removed);
+
+        SOUND_EVENT << INDEX_PROGRESS << found;
+        if (auto now = esp_timer_get_time(); now - last_checkpoint >= SOUND_INDEXER_CHECKPOINT_INTERVAL * 1000LL)
+        {
+            checkpoint();
+            last_checkpoint = now;
+        }
+    }
+
+    // fingerprints of removed directories are dropped; a resumed scan didn't visit the directories scanned
+    // before the reboot, so it keeps all of them, and the next complete scan drops those of removed directories
+    if (kind != Scan::resumed)
+        std::erase_if(m_dirs, [](const DirPrint& dir) { return !dir.visited; });
+    checkpoint();
+    LOG_I("Sound scan found %u new or changed sounds and removed %u sounds in %lld ms",
+          found, removed, (esp_timer_get_time() - start) / 1000);
+    m_running = false;
+    SOUND_EVENT << INDEX_COMPLETED << found;
+}
+
+void SoundIndexer::scan(const String& path, uint32_t& found, uint32_t& removed)
+{
+    auto* dir = opendir((String(SD.mountpoint()) + path).c_str());
+    if (!dir)
+        return;
+
+    struct Candidate
+    {
+        String path;
+        String name;
+        uint32_t fingerprint;
+    };
+    std::vector<Candidate> sounds{};
+    std::vector<String> entries{};
+    // the hashes of the entries are hashed in sorted order, so the order of listing the entries doesn't matter
+    std::vector<uint32_t> hashes{};
+    auto prefix = path.endsWith("/") ? path : path + "/";
+
+    // the entries are listed without opening them; only sounds whose fingerprint changed are opened below
+    while (auto* entry = readdir(dir))
+    {
+        auto child = prefix + entry->d_name;
+        if (entry->d_type == DT_DIR)
+        {
+            m_pending.push_back(child);
+            entries.emplace_back(entry->d_name);
+            // the separator tells directories from files of the same name
+            hashes.push_back(fnv1a("/", fnv1a(entry->d_name)));
+        }
+        else if (String name{entry->d_name}; name.endsWith(".mp3"))
+        {
+            struct stat info{};
+            stat((String(SD.mountpoint()) + child).c_str(), &info);
+            uint32_t size = info.st_size;
+            uint32_t mtime = info.st_mtime;
+            auto hash = fnv1a(&mtime, sizeof(mtime), fnv1a(&size, sizeof(size), fnv1a(entry->d_name)));
+            hashes.push_back(hash);
+            entries.push_back(name);
+            sounds.push_back({std::move(child), name.substring(0, name.lastIndexOf(".mp3")), hash});
+        }
+        pace();
+    }
+    closedir(dir);
+    std::ranges::sort(hashes);
+    auto fingerprint = fnv1a(hashes.data(), hashes.size() * sizeof(uint32_t));
+
+    auto path_hash = fnv1a(path.c_str());
+    auto it = std::ranges::lower_bound(m_dirs, path_hash, {}, &DirPrint::path);
+    auto known = it != m_dirs.end() && it->path == path_hash;
+    if (!known)
+        it = m_dirs.insert(it, {path_hash, 0, false});
+    it->visited = true;
+    if (known && it->fingerprint == fingerprint)
+        return;
+
+    std::ranges::sort(entries);
+    removed += m_sounds.retainSounds(path, entries);
+    for (const auto& sound : sounds)
+    {
+        if (m_sounds.hasFile(sound.path.c_str(), sound.fingerprint))
+            continue;
+
+        // the metadata is read once here, so playing or listing a sound never parses its file
+        auto file = SD.open(sound.path, FILE_READ);
+        if (!file)
+            continue;
+        auto info = Mp3Info::read(file);
+        file.close();
+        info.audio.fingerprint = sound.fingerprint;
+        if (m_sounds.addSound(sound.path.c_str(), sound.name, info.title, info.audio))
+            ++found;
+        pace();
+    }
+    it->fingerprint = fingerprint;
+}
+
+void SoundIndexer::pace()
+{
+    // reading the SD card during playback would delay the audio task's reads
+    while (m_paused)
+        vTaskDelay(pdMS_TO_TICKS(100));
+
+    if (++m_entries % SOUND_INDEXER_BATCH_SIZE == 0)
+        vTaskDelay(pdMS_TO_TICKS(SOUND_INDEXER_BATCH_PAUSE));
+}
+
+void SoundIndexer::checkpoint()
+{
+    // the sounds are stored first; sounds of directories scanned again after a reboot are skipped when added
+    m_sounds.store();
+
+    std::vector<uint8_t> contents{};
+    contents.reserve(m_dirs.size() * 2 * sizeof(uint32_t));
+    for (const auto& dir : m_dirs)
+    {
+        const auto* path = reinterpret_cast<const uint8_t*>(&dir.path);
+        const auto* fingerprint = reinterpret_cast<const uint8_t*>(&dir.fingerprint);
+        contents.insert(contents.end(), path, path + sizeof(dir.path));
+        contents.insert(contents.end(), fingerprint, fingerprint + sizeof(dir.fingerprint));
+    }
+    atomic_file::replace(SD, m_dirs_file.c_str(), [&](File& file) { return write_state(file, c_dirs_magic, contents); });
+
+    if (m_pending.empty())
+    {
+        SD.remove(m_state_file);
+        return;
+    }
+
+    contents.clear();
+    for (const auto& path : m_pending)
+    {
+        contents.insert(contents.end(), path.c_str(), path.c_str() + path.length());
+        contents.push_back('\n');
+    }
+    atomic_file::replace(SD, m_state_file.c_str(), [&](File& file) { return write_state(file, c_state_magic, contents); });
+}
@@ -0,0 +1,133 @@
+#ifndef SOUND_INDEXER_H
+#define SOUND_INDEXER_H
+
+#include <Arduino.h>
+#include "util/thread.hpp"
+#include "util/blocking_queue.hpp"
+#include <atomic>
+#include <vector>
+
+#ifndef SOUND_INDEXER_STACK_SIZE
+#define SOUND_INDEXER_STACK_SIZE 6144
+#endif
+
+#ifndef SOUND_INDEXER_BATCH_SIZE
+// directory entries read before yielding the SD card to other tasks
+#define SOUND_INDEXER_BATCH_SIZE 8
+#endif
+
+#ifndef SOUND_INDEXER_BATCH_PAUSE
+// milliseconds to pause after each batch of directory entries
+#define SOUND_INDEXER_BATCH_PAUSE 20
+#endif
+
+#ifndef SOUND_INDEXER_CHECKPOINT_INTERVAL
+// milliseconds between storing the sounds found so far together with the scan state
+#define SOUND_INDEXER_CHECKPOINT_INTERVAL 5000
+#endif
+
+
+class SoundManager;
+
+
+/**
+ * Background task scanning the SD card for sounds and adding them to a sound manager
+ *
+ * The directories are scanned iteratively, one at a time; the directories still to be scanned are written
+ * to a state file together with storing the sounds found at regular checkpoints,
+ * so a scan interrupted by a reboot is resumed instead of restarted.
+ *
+ * Each directory is fingerprinted by the names of its entries and the sizes and modification times of its sounds;
+ * the fingerprints are stored next to the index, so a rescan only updates the sounds of changed directories
+ * and only opens the files that changed. As FAT doesn't update the modification time of directories,
+ * the directories themselves are still listed.
+ * Both files carry a checksum; invalid fingerprints count every directory as changed
+ * and an invalid scan state restarts the scan.
+ * The scan yields the SD card after each batch of directory entries and pauses while audio is played,
+ * so it does not cause playback underruns;
+ * progress is reported by SOUND_EVENT events
+ */
+class SoundIndexer final : Thread<SOUND_INDEXER_STACK_SIZE>
+{
+public:
+    /**
+     * Constructor
+     * @param sounds The sound manager to add found sounds to
+     * @param index_file The path of the sound index, next to which the scan state and fingerprints are stored
+     */
+    SoundIndexer(SoundManager& sounds, const String& index_file);
+
+    /**
+     * Registers the event listeners pausing the scan during playback and loads the directory fingerprints;
+     * must be called after initializing events
+     */
+    void begin();
+
+    /**
+     * Starts a new scan of the whole SD card, reading every sound's file
+     */
+    void start();
+
+    /**
+     * Starts a scan of the SD card updating the sounds of directories changed since the last scan
+     */
+    void rescan();
+
+    /**
+     * Resumes a scan interrupted by a reboot, if any; an unfinished scan whose state file is invalid is restarted
+     * @return true if an unfinished scan was found and resumed or restarted
+     */
+    bool resume();
+
+    /**
+     * Get whether a scan is running
+     */
+    [[nodiscard]] bool running() const { return m_running; }
+
+private:
+    /**
+     * Kind of scan requested from the indexer task
+     */
+    enum class Scan : uint8_t
+    {
+        //! Scanning all directories, reading every sound's file
+        full,
+        //! Scanning all directories, updating the sounds of changed ones
+        changed,
+        //! Continuing an interrupted scan with the directories of the state file
+        resumed
+    };
+
+    /**
+     * Fingerprint of a scanned directory
+     */
+    struct DirPrint
+    {
+        //! Hash of the directory's path
+        uint32_t path;
+        uint32_t fingerprint;
+        // whether the directory was found by the current scan; directories not found are dropped when it completes,
+        // unless the scan was resumed, as the directories scanned before the reboot weren't visited again
+        bool visited;
+    };
+
+    void run() override;
+    void scan(const String& path, uint32_t& found, uint32_t& removed);
+    void pace();
+    void checkpoint();
+
+    SoundManager& m_sounds;
+    String m_state_file;
+    String m_dirs_file;
+    // sorted by path hash
+    std::vector<DirPrint> m_dirs{};
+    // directories still to be scanned, the next one at the back
+    std::vector<String> m_pending{};
+    ESPQueue<1, Scan> m_trigger{};
+    std::atomic<bool> m_running{false};
+    std::atomic<bool> m_paused{false};
+    uint32_t m_entries{};
+};
+
+
+#endif //SOUND_INDEXER_H
@@ -0,0 +1,147 @@
+#include "sound_journal.h"
+
+#include <esp_rom_crc.h>
+#include <vector>
+#include "log.h"
+#include "util/atomic_file.hpp"
+
+
+static constexpr uint8_t c_flag_allow_random = 0x01;
+// number and flags preceding the strings of a record's payload
+static constexpr size_t c_payload_head = sizeof(uint32_t) + sizeof(uint8_t);
+// payload size and CRC surrounding a record's payload
+static constexpr size_t c_record_overhead = sizeof(uint16_t) + sizeof(uint32_t);
+
+
+SoundJournal::SoundJournal(String path, FS& fs):
+    m_path(std::move(path)),
+    m_fs(fs) {}
+
+size_t SoundJournal::replay(const std::function<void(const Sound&)>& apply)
+{
+    atomic_file::recover(m_fs, m_path.c_str());
+    m_size = 0;
+    auto file = m_fs.open(m_path, FILE_READ);
+    if (!file)
+        return 0;
+
+    std::vector<uint8_t> data(file.size());
+    auto size = file.read(data.data(), data.size());
+    file.close();
+
+    size_t offset = 0;
+    size_t records = 0;
+    while (offset + c_record_overhead <= size)
+    {
+        uint16_t length;
+        memcpy(&length, data.data() + offset, sizeof(length));
+        if (length < c_payload_head + 2 || offset + c_record_overhead + length > size)
+            break;
+
+        auto* payload = data.data() + offset + sizeof(length);
+        uint32_t crc;
+        memcpy(&crc, payload + length, sizeof(crc));
+        if (esp_rom_crc32_le(0, payload, length) != crc)
+            break;
+
+        // both strings must be terminated inside the payload
+        auto* path = reinterpret_cast<const char*>(payload + c_payload_head);
+        auto* end = reinterpret_cast<const char*>(payload + length);
+        auto* path_end = static_cast<const char*>(memchr(path, '\0', end - path));
+        if (!path_end || !memchr(path_end + 1, '\0', end - path_end - 1))
+            break;
+
+        uint32_t number;
+        memcpy(&number, payload, sizeof(number));
+        apply(Sound{number, path, path_end + 1, (payload[4] & c_flag_allow_random) != 0});
+
+        offset += c_record_overhead + length;
+        ++records;
+    }
+
+    // appending after an incomplete record would hide all later records from the next replay
+    if (offset < data.size())
+    {
+        LOG_W("Discarding %u bytes of incomplete records from %s", data.size() - offset, m_path.c_str());
+        if (offset == 0)
+        {
+            m_fs.remove(m_path);
+        }
+        else
+        {
+            atomic_file::replace(m_fs, m_path.c_str(), [&](File& f)
+            {
+                return f.write(data.data(), offset) == offset;
+            });
+        }
+    }
+
+    m_size = offset;
+    return records;
+}
+
+bool SoundJournal::append(const Sound& sound)
+{
+    auto length = c_payload_head + sound.path.length() + 1 + sound.name.length() + 1;
+    std::vector<uint8_t> record(c_record_overhead + length);
+
+    auto* payload = record.data() + sizeof(uint16_t);
+    auto add = [&](uint8_t* at, const String& str)
+    {
+        if (str.length())
+            memcpy(at, str.c_str(), str.length());
+        at[str.length()] = '\0';
+        return at + str.length() + 1;
+    };
+    auto size = static_cast<uint16_t>(length);
+    uint32_t number = sound.number;
+    memcpy(record.data(), &size, sizeof(size));
+    memcpy(payload, &number, sizeof(number));
+    payload[4] = sound.allow_random ? c_flag_allow_random : 0;
+    add(add(payload + c_payload_head, sound.path), sound.name);
+    auto crc = esp_rom_crc32_le(0, payload, length);
+    memcpy(payload + length, &crc, sizeof(crc));
+
+    auto file = m_fs.open(m_path, FILE_APPEND);
+    if (!file)
+    {
+        LOG_E("Failed to open %s for appending", m_path.c_str());
+        return false;
+    }
+    auto written = file.write(record.data(), record.size());
+    file.close();
+
+    // count partially written records as well, so discarding the journal removes them
+    m_size += written;
+    if (written != record.size())
+    {
+        LOG_E("Failed to append to %s", m_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void SoundJournal::discard(size_t length)
+{
+    if (length >= m_size)
+    {
+        if (m_fs.exists(m_path))
+            m_fs.remove(m_path);
+        m_size = 0;
+        return;
+    }
+
+    // keep the records appended since the given length was taken
+    std::vector<uint8_t> tail(m_size - length);
+    auto file = m_fs.open(m_path, FILE_READ);
+    auto ok = file && file.seek(length) && file.read(tail.data(), tail.size()) == tail.size();
+    file.close();
+
+    if (ok && atomic_file::replace(m_fs, m_path.c_str(), [&](File& f)
+    {
+        return f.write(tail.data(), tail.size()) == tail.size();
+    }))
+    {
+        m_size = tail.size();
+    }
+}
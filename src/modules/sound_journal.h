@@ -0,0 +1,62 @@
+#ifndef SOUND_JOURNAL_H
+#define SOUND_JOURNAL_H
+
+#include <FS.h>
+#include <SD.h>
+#include <functional>
+#include "sound_manager.h"
+
+
+/**
+ * Append-only journal of sound attribute changes not yet folded into the sound index;
+ * each change is appended as a single record holding the complete attributes of the changed sound,
+ * so replaying a record is idempotent and the journal may be replayed on top of an index already containing it
+ *
+ * Record layout (little endian): payload size (u16), payload, CRC32 of the payload (u32);
+ * the payload holds the sound number (u32), flags (u8) and the null-terminated path and name
+ */
+class SoundJournal
+{
+public:
+    /**
+     * Constructor
+     * @param path The path of the journal file
+     * @param fs The filesystem of the journal file
+     */
+    explicit SoundJournal(String path, FS& fs = SD);
+
+    /**
+     * Reads the journal and passes the recorded sounds to the given function in the order they were appended;
+     * an incomplete record at the end, left by a power loss while appending, is removed
+     * @param apply The function to pass the recorded sounds to
+     * @return The number of records replayed
+     */
+    size_t replay(const std::function<void(const Sound&)>& apply);
+
+    /**
+     * Appends a record of a sound's attributes
+     * @param sound The changed sound
+     * @return true if the record was written
+     */
+    bool append(const Sound& sound);
+
+    /**
+     * Removes the given number of bytes from the start of the journal, after they were folded into the index;
+     * records appended in the meantime are kept
+     * @param length The journal size at the time of taking the state written to the index
+     */
+    void discard(size_t length);
+
+    /**
+     * Get the size of the journal file in bytes
+     */
+    [[nodiscard]] size_t size() const { return m_size; }
+
+private:
+    String m_path;
+    FS& m_fs;
+    size_t m_size{};
+};
+
+
+#endif //SOUND_JOURNAL_H
@@ -1,93 +1,266 @@
 #include "sound_manager.h"
 
 #include "log.h"
+#include "sound_index.h"
+#include "sound_indexer.h"
+#include "sound_journal.h"
 #include "util/std_container_json.hpp"
-#include "util/json_file.hpp";
+#include "util/json_file.hpp"
+#include "util/atomic_file.hpp"
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <esp_timer.h>
+#include <mutex>
 #include <utility>
 
 
-Sound::Sound(uint8_t number):
-    number(number),
-    allow_random() {}
-
-Sound::Sound(uint8_t number, const char* path, const char* name, bool allow_random):
+Sound::Sound(uint32_t number, const char* path, const char* name, bool allow_random):
     number(number),
     path(path),
     name(name),
     allow_random(allow_random) {}
 
-Sound::Sound(uint8_t number, String path, const char* name, bool allow_random) :
+Sound::Sound(uint32_t number, String path, const char* name, bool allow_random) :
     number(number),
     path(std::move(path)),
     name(name),
     allow_random(allow_random) {}
 
-Sound::Sound(uint8_t number, const char* path, String name, bool allow_random):
+Sound::Sound(uint32_t number, const char* path, String name, bool allow_random):
     number(number),
     path(path),
     name(std::move(name)),
     allow_random(allow_random) {}
 
-Sound::Sound(uint8_t number, String path, String name, bool allow_random) :
+Sound::Sound(uint32_t number, String path, String name, bool allow_random) :
     number(number),
     path(std::move(path)),
     name(std::move(name)),
     allow_random(allow_random) {}
 
 
-Sound::Proxy::Proxy(const Sound& sound, SoundManager& sound_manager) noexcept:
+/**
+ * Gets the FNV-1a hash of a path, the preferred number of the sound of a file
+ */
+static uint32_t pathHash(const char* path)
+{
+    uint32_t hash = 2166136261u;
+    for (auto* c = path; *c; ++c)
+        hash = (hash ^ static_cast<uint8_t>(*c)) * 16777619u;
+    return hash;
+}
+
+
+// Strings of sounds created from a null pointer may not have a buffer
+static const char* cstr(const String& str)
+{
+    return str.c_str() ? str.c_str() : "";
+}
+
+
+Sound::Proxy::Proxy(SoundManager& sound_manager, std::unique_lock<std::mutex>&& lock, size_t row) noexcept:
     m_sound_manager(sound_manager),
-    number(sound.number),
-    allow_random(sound.allow_random),
-    name(sound.name),
-    path(sound.path) {}
+    m_lock(std::move(lock)),
+    m_row(row) {}
+
+uint32_t Sound::Proxy::number() const
+{
+    return m_sound_manager.m_sounds.number(m_row);
+}
+
+bool Sound::Proxy::allowRandom() const
+{
+    return m_sound_manager.m_sounds.allowRandom(m_row);
+}
+
+const char* Sound::Proxy::name() const
+{
+    return m_sound_manager.m_sounds.name(m_row);
+}
+
+const char* Sound::Proxy::path() const
+{
+    return m_sound_manager.m_sounds.path(m_row);
+}
+
+const char* Sound::Proxy::title() const
+{
+    return m_sound_manager.m_sounds.title(m_row);
+}
+
+const SoundTable::Metadata& Sound::Proxy::metadata() const
+{
+    return m_sound_manager.m_sounds.metadata(m_row);
+}
+
+void Sound::Proxy::setAllowRandom(bool allow_random)
+{
+    if (allow_random != allowRandom())
+    {
+        m_sound_manager.m_sounds.setAllowRandom(m_row, allow_random);
+        m_sound_manager.m_deck.invalidate();
+        m_sound_manager.journal(m_row);
+    }
+}
 
-Sound::Proxy::~Proxy()
+void Sound::Proxy::setName(const char* name)
 {
-    m_sound_manager.setSound(Sound{number, path, name, allow_random});
+    if (strcmp(name ? name : "", this->name()) != 0 && m_sound_manager.m_sounds.setName(m_row, name))
+        m_sound_manager.journal(m_row);
+}
+
+void Sound::Proxy::setPath(const char* path)
+{
+    if (strcmp(path ? path : "", this->path()) != 0 && m_sound_manager.m_sounds.setPath(m_row, path))
+        m_sound_manager.journal(m_row);
 }
 
 
-SoundManager::SoundManager(const char* config_file):
+SoundManager::SoundManager(const char* index_file, const char* json_file):
     BootProcess("Loaded sounds"),
-    m_config_file(config_file) {}
+    m_index_file(index_file),
+    m_json_file(json_file),
+    m_journal(std::make_unique<SoundJournal>(String(index_file) + ".jnl")),
+    m_indexer(std::make_unique<SoundIndexer>(*this, String(index_file))) {}
+
+SoundManager::~SoundManager() = default;
 
 void SoundManager::store() const
 {
-    LOG_D("Writing sounds to config file");
-    JsonFile::w(m_config_file).set(m_sounds);
+    // serializes the compaction with storing after replacing all sounds
+    std::scoped_lock store_lock{m_store_mutex};
+
+    SoundTable sounds;
+    size_t journaled;
+    {
+        std::scoped_lock lock{m_mutex};
+        sounds = m_sounds;
+        journaled = m_journal->size();
+    }
+
+    LOG_D("Writing %u sounds to index file", sounds.size());
+    if (SoundIndex::write(m_index_file, sounds))
+    {
+        std::scoped_lock lock{m_mutex};
+        m_journal->discard(journaled);
+    }
 }
 
-SoundManager::Optional SoundManager::operator[](uint8_t number)
+void SoundManager::rescan()
 {
-    if (number == 0)
-        return selectRandom();
+    m_indexer->rescan();
+}
 
-    if (auto it = m_sounds.find(number); it != m_sounds.end())
-        return makeProxy(*it);
+void SoundManager::exportJson(const char* path) const
+{
+    auto start = esp_timer_get_time();
+    size_t size = 0;
+    auto ok = atomic_file::replace(SD, path, [&](File& file)
+    {
+        JsonFile::BufferedWriter writer{file};
+        size = exportJson(writer);
+        writer.flush();
+        return writer.ok;
+    });
+    if (ok)
+        LOG_D("Exported %u sounds (%u bytes) to %s in %lld us", this->size(), size, path, esp_timer_get_time() - start);
+}
 
-    return std::nullopt;
+size_t SoundManager::exportJson(Print& out) const
+{
+    std::scoped_lock lock{m_mutex};
+    return serializeJsonArray(m_sounds, out);
 }
 
-void SoundManager::setSounds(const Collection& sounds)
+bool SoundManager::importJson(const char* path)
 {
-    m_sounds = sounds;
+    auto json = JsonFile::r(path);
+    if (auto err = json.error())
+    {
+        if (err != DeserializationError::EmptyInput)
+            LOG_E("Error loading %s: %s", path, err.c_str());
+        return false;
+    }
+
+    setSounds(json.as<decltype(m_sounds)>());
+    return true;
+}
+
+SoundManager::Optional SoundManager::operator[](uint32_t number)
+{
+    std::unique_lock lock{m_mutex};
+    auto row = number == 0 ? selectRandom() : m_sounds.find(number);
+    if (row == SoundTable::npos)
+        return std::nullopt;
+
+    return std::make_optional<Sound::Proxy>(*this, std::move(lock), row);
+}
+
+SoundManager::Optional SoundManager::peekRandom()
+{
+    std::unique_lock lock{m_mutex};
+    auto number = m_deck.peek(m_sounds);
+    auto row = number ? m_sounds.find(*number) : SoundTable::npos;
+    if (row == SoundTable::npos)
+        return std::nullopt;
+
+    return std::make_optional<Sound::Proxy>(*this, std::move(lock), row);
+}
+
+size_t SoundManager::size() const
+{
+    std::scoped_lock lock{m_mutex};
+    return m_sounds.size();
+}
 
-    // ensure sound 0 represents random sound selection
-    if (auto random_s = m_sounds.find(0); random_s == m_sounds.end())
+size_t SoundManager::list(size_t offset, size_t limit, const char* filter,
+                          const std::function<void(const SoundTable::View&, size_t)>& visit) const
+{
+    std::scoped_lock lock{m_mutex};
+    if (!filter || !*filter)
     {
-        m_sounds.emplace(0, nullptr, "RANDOM", false);
+        // without a filter the page is addressed by row directly
+        for (auto row = offset; row < m_sounds.size() && row - offset < limit; ++row)
+            visit(m_sounds.view(row), row);
+        return m_sounds.size();
     }
-    else if (random_s->allow_random)
+
+    size_t matches = 0;
+    for (size_t row = 0; row < m_sounds.size(); ++row)
     {
-        if (auto node = m_sounds.extract(random_s))
+        if (!strcasestr(m_sounds.name(row), filter))
+            continue;
+        if (matches >= offset && matches - offset < limit)
+            visit(m_sounds.view(row), matches);
+        ++matches;
+    }
+    return matches;
+}
+
+void SoundManager::setSounds(const Collection& sounds)
+{
+    {
+        std::scoped_lock lock{m_mutex};
+        size_t strings = 0;
+        for (const auto& sound : sounds)
+            strings += sound.path.length() + 1 + sound.name.length() + 1;
+        m_sounds.clear();
+        m_sounds.reserve(sounds.size() + 1, strings);
+
+        for (const auto& sound : sounds)
         {
-            auto& value = node.value();
-            // sound 0 might never be picked randomly
-            value.allow_random = false;
-            value.path = static_cast<const char*>(nullptr);
-            m_sounds.insert(std::move(node));
+            // sound 0 represents random sound selection, thus might never be picked randomly and has no file
+            if (sound.number == 0)
+                m_sounds.insert(0, nullptr, cstr(sound.name), false);
+            else
+                m_sounds.insert(sound.number, cstr(sound.path), cstr(sound.name), sound.allow_random);
         }
+
+        // ensure sound 0 represents random sound selection
+        if (m_sounds.find(0) == SoundTable::npos)
+            m_sounds.insert(0, nullptr, "RANDOM", false);
+        m_deck.invalidate();
+        checkNumbers();
     }
 
     store();
@@ -95,129 +268,207 @@ void SoundManager::setSounds(const Collection& sounds)
 
 void SoundManager::setSound(const Sound& sound)
 {
-    if (auto node = m_sounds.extract(sound.number))
+    std::scoped_lock lock{m_mutex};
+    if (apply(sound))
+        journal(m_sounds.find(sound.number));
+}
+
+bool SoundManager::apply(const Sound& sound)
+{
+    auto row = m_sounds.find(sound.number);
+    if (row == SoundTable::npos)
+        return false;
+
+    auto changed = sound.allow_random != m_sounds.allowRandom(row) ||
+        strcmp(cstr(sound.name), m_sounds.name(row)) != 0 ||
+        strcmp(cstr(sound.path), m_sounds.path(row)) != 0;
+    if (changed)
     {
-        if (auto& current = node.value();
-            sound.allow_random != current.allow_random ||
-            sound.name != current.name ||
-            sound.path != current.path)
-        {
-            current.allow_random = sound.allow_random;
-            if (sound.name != current.name) current.name = sound.name;
-            if (sound.path != current.path) current.path = sound.path;
+        if (sound.allow_random != m_sounds.allowRandom(row))
+            m_deck.invalidate();
+        m_sounds.setAllowRandom(row, sound.allow_random);
+        m_sounds.setName(row, cstr(sound.name));
+        m_sounds.setPath(row, cstr(sound.path));
+    }
+    return changed;
+}
 
-            m_sounds.insert(std::move(node));
-            store();
-        }
+void SoundManager::journal(size_t row)
+{
+    // only the change is written; the index is rewritten once the journal grew large enough
+    auto sound = m_sounds.view(row);
+    if (!m_journal->append(Sound{sound.number, sound.path, sound.name, sound.allow_random}) ||
+        m_journal->size() >= SOUND_JOURNAL_COMPACT_SIZE)
+    {
+        m_compaction_timer.reset();
     }
 }
 
-static void searchRecursive(Sound::Collection& col, File& dir, int d = 0) // NOLINT(*-no-recursion)
+bool SoundManager::addSound(const char* path, const String& name, const char* title,
+                            const SoundTable::Metadata& metadata)
 {
-    for (auto entry = dir.openNextFile(); entry; entry = dir.openNextFile())
+    std::scoped_lock lock{m_mutex};
+    uint32_t number;
+    if (auto row = findPath(path, number); row != SoundTable::npos)
     {
-        if (entry.isDirectory())
-        {
-            searchRecursive(col, entry, d + 1);
-        }
-        else if (String name{entry.name()}; name.endsWith(".mp3"))
+        // a changed file keeps its number and the attributes set by the user
+        if (m_sounds.metadata(row).fingerprint == metadata.fingerprint)
+            return false;
+        return m_sounds.setMetadata(row, title, metadata);
+    }
+
+    if (number == 0)
+    {
+        LOG_W("No sound number left for %s", path);
+        return false;
+    }
+    if (m_sounds.insert(number, path, cstr(name), true, title, metadata) == SoundTable::npos)
+        return false;
+    m_deck.invalidate();
+    return true;
+}
+
+bool SoundManager::hasFile(const char* path, uint32_t fingerprint) const
+{
+    std::scoped_lock lock{m_mutex};
+    uint32_t number;
+    auto row = findPath(path, number);
+    return row != SoundTable::npos && m_sounds.metadata(row).fingerprint == fingerprint;
+}
+
+size_t SoundManager::retainSounds(const String& dir, const std::vector<String>& entries)
+{
+    auto prefix = dir.endsWith("/") ? dir : dir + "/";
+    std::scoped_lock lock{m_mutex};
+    size_t removed = 0;
+    for (size_t row = m_sounds.size(); row-- > 0;)
+    {
+        auto* path = m_sounds.path(row);
+        if (strncmp(path, prefix.c_str(), prefix.length()) != 0)
+            continue;
+
+        // the entry of the directory holding the sound is the file itself or a subdirectory
+        auto* entry = path + prefix.length();
+        auto* slash = strchr(entry, '/');
+        String name = slash ? String(entry).substring(0, slash - entry) : String(entry);
+        if (!std::ranges::binary_search(entries, name))
         {
-            auto index = name.indexOf(".mp3");
-            col.emplace(col.size(), entry.path(), name.substring(0, index), true);
+            m_sounds.erase(row);
+            ++removed;
         }
-        entry.close();
     }
+    if (removed)
+        m_deck.invalidate();
+    return removed;
 }
 
-void SoundManager::runBootProcess()
+size_t SoundManager::findPath(const char* path, uint32_t& free_number) const
 {
-    auto json = JsonFile::r(m_config_file);
-    if (auto err = json.error())
+    // colliding paths take one of the numbers following the hash, 0 is reserved for random selection
+    auto hash = pathHash(path);
+
+    // all candidates are checked, as removed sounds leave gaps in front of colliding sounds
+    free_number = 0;
+    for (uint32_t i = 0; i < c_number_probes; ++i)
     {
-        if (err == DeserializationError::EmptyInput)
+        auto number = hash + i;
+        if (number == 0)
+            continue;
+        auto row = m_sounds.find(number);
+        if (row == SoundTable::npos)
         {
-            LOG_W("Config file doesn't exist or is empty, generating config");
-            m_sounds.clear();
-            // sound 0 always represents random sound selection
-            m_sounds.emplace(0, nullptr, "RANDOM", false);
-
-            auto root = SD.open("/");
-            if (root && root.isDirectory())
-            {
-                searchRecursive(m_sounds, root);
-            }
-            root.close();
-
-            // size - 1: sound 0 represents a random sound thus doesn't add to real sound count
-            LOG_I("Loaded %d sounds from file system", m_sounds.size() - 1);
-            store();
+            if (free_number == 0)
+                free_number = number;
         }
-        else
+        else if (strcmp(m_sounds.path(row), path) == 0)
         {
-            LOG_E("Error loading config file: %s", err.c_str());
+            return row;
         }
     }
-    else
+
+    if (m_unhashed)
     {
-        setSounds(json.as<decltype(m_sounds)>());
-        // size - 1: sound 0 represents a random sound thus doesn't add to real sound count
-        LOG_I("Loaded %d sounds from config file", m_sounds.size() - 1);
+        for (size_t row = 0; row < m_sounds.size(); ++row)
+        {
+            if (strcmp(m_sounds.path(row), path) == 0)
+                return row;
+        }
     }
+    return SoundTable::npos;
 }
 
-SoundManager::Optional SoundManager::selectRandom()
+void SoundManager::checkNumbers()
 {
-    if (auto s = trySelectRandom()) return makeProxy(*s);
-
-    LOG_I("Could not select random sound, resetting played flags");
-    for (auto& sound : m_sounds)
+    m_unhashed = false;
+    for (size_t row = 0; row < m_sounds.size() && !m_unhashed; ++row)
     {
-        sound.was_played = false;
+        auto number = m_sounds.number(row);
+        m_unhashed = number != 0 && number - pathHash(m_sounds.path(row)) >= c_number_probes;
     }
-
-    if (auto s = trySelectRandom()) return makeProxy(*s);
-    return std::nullopt;
+    if (m_unhashed)
+        LOG_D("Sounds aren't numbered by their paths, scans search paths linearly");
 }
 
-std::optional<const Sound> SoundManager::trySelectRandom()
+void SoundManager::runBootProcess()
 {
-    std::vector<uint8_t> candidates;
-    candidates.reserve(m_sounds.size());
+    // compaction writes to the SD card, which would block the timer service
+    m_compaction_timer.setDeferred(true);
+    m_compaction_timer.once(SOUND_JOURNAL_COMPACT_DELAY, [this] { store(); });
+    m_indexer->begin();
 
-    for (auto& sound : m_sounds)
+    auto start = esp_timer_get_time();
+    if (SoundIndex::load(m_index_file, m_sounds))
     {
-        if (sound.allow_random && !sound.was_played)
-        {
-            candidates.push_back(sound.number);
-        }
+        auto changes = m_journal->replay([this](const Sound& sound) { apply(sound); });
+        checkNumbers();
+
+        // size - 1: sound 0 represents a random sound thus doesn't add to real sound count
+        LOG_I("Loaded %d sounds from index file and %u journaled changes in %lld us",
+              m_sounds.size() - 1, changes, esp_timer_get_time() - start);
+        LOG_D("Sound table holds %u sounds in %u bytes; internal heap: %u bytes free, largest block %u bytes",
+              m_sounds.size(), m_sounds.memoryUsage(),
+              heap_caps_get_free_size(MALLOC_CAP_INTERNAL), heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+        if (m_journal->size() >= SOUND_JOURNAL_COMPACT_SIZE)
+            m_compaction_timer.reset();
+        // sounds may have been changed on the card while the clock was off
+        if (!m_indexer->resume())
+            m_indexer->rescan();
+        return;
     }
 
-    if (!candidates.empty())
+    // a JSON configuration of a previous firmware is migrated into the index
+    if (importJson(m_json_file))
     {
-        uint8_t idx = random(static_cast<long>(candidates.size()));
-        if (auto selected = m_sounds.find(candidates[idx]); selected != m_sounds.end())
-        {
-            selected->was_played = true;
-            LOG_I("Randomly selected sound number %d", selected->number);
-            return *selected;
-        }
+        // size - 1: sound 0 represents a random sound thus doesn't add to real sound count
+        LOG_I("Imported %d sounds from %s", m_sounds.size() - 1, m_json_file);
+        return;
     }
 
-    LOG_I("No eligible sounds found");
-    return std::nullopt;
+    LOG_W("Sound index doesn't exist or is invalid, generating index in the background");
+    {
+        std::scoped_lock lock{m_mutex};
+        m_sounds.clear();
+        // sound 0 always represents random sound selection
+        m_sounds.insert(0, nullptr, "RANDOM", false);
+    }
+    m_indexer->start();
 }
 
-SoundManager::Optional SoundManager::makeProxy(const Sound& sound)
+size_t SoundManager::selectRandom()
 {
-    return std::make_optional<Sound::Proxy>(sound, *this);
+    if (auto number = m_deck.draw(m_sounds))
+    {
+        LOG_I("Randomly selected sound number %lu", *number);
+        return m_sounds.find(*number);
+    }
+
+    LOG_I("No eligible sounds found");
+    return SoundTable::npos;
 }
 
 void Converter<Sound>::toJson(const Sound& src, JsonVariant dst)
 {
-    dst["id"] = src.number;
-    dst["path"] = src.path.c_str();
-    dst["name"] = src.name.c_str();
-    dst["allow_random"] = src.allow_random;
+    Converter<SoundTable::View>::toJson({src.number, cstr(src.path), cstr(src.name), src.allow_random, "", {}}, dst);
 }
 
 Sound Converter<Sound>::fromJson(JsonVariantConst src)
@@ -233,8 +484,25 @@ Sound Converter<Sound>::fromJson(JsonVariantConst src)
 bool Converter<Sound>::checkJson(JsonVariantConst src)
 {
     return
-        src["id"].is<uint8_t>() &&
+        src["id"].is<uint32_t>() &&
         src["path"].is<const char*>() &&
         src["name"].is<const char*>() &&
         src["allow_random"].is<bool>();
 }
+
+void Converter<SoundTable::View>::toJson(const SoundTable::View& src, JsonVariant dst)
+{
+    dst["id"] = src.number;
+    dst["path"] = src.path;
+    dst["name"] = src.name;
+    dst["allow_random"] = src.allow_random;
+    // metadata is read from the files by the indexer, so it is exported but never imported
+    if (*src.title)
+        dst["title"] = src.title;
+    if (src.metadata.duration_ms)
+    {
+        dst["duration_ms"] = src.metadata.duration_ms;
+        dst["sample_rate"] = src.metadata.sample_rate;
+        dst["bitrate"] = src.metadata.bitrate;
+    }
+}
@@ -1,76 +1,97 @@
 #ifndef SOUND_MANAGER_H
 #define SOUND_MANAGER_H
 
+#include "sound_deck.h"
+#include "sound_table.h"
 #include "util/boot_process.hpp"
+#include "util/timer.h"
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <vector>
 #include <ArduinoJson/Variant/JsonVariant.hpp>
 
 
 // TODO: Test with real hardware!
 
 
+#ifndef SOUND_JOURNAL_COMPACT_SIZE
+// journal size in bytes after which the journaled changes are folded into the sound index
+#define SOUND_JOURNAL_COMPACT_SIZE 4096
+#endif
+
+#ifndef SOUND_JOURNAL_COMPACT_DELAY
+// seconds without further changes to wait before compacting, so a burst of changes is compacted once
+#define SOUND_JOURNAL_COMPACT_DELAY 10
+#endif
+
+
 // forward declaration necessary for Sound::Proxy class
 class SoundManager;
+class SoundJournal;
+class SoundIndexer;
 
 
 /**
-* Class representing MP3 sounds stored on the SD card
+* Class representing MP3 sounds stored on the SD card;
+* used for importing sounds and for recording changes, the managed sounds are held by a SoundTable
 */
 class Sound
 {
-    friend class SoundManager;
-    friend class Proxy;
-    // for using number to find a sound in the collection
-    explicit(false) Sound(uint8_t number);
-    // allow modification through const iterator/reference returned from unordered_set
-    mutable bool was_played{};
-
 public:
     class Proxy;
     using Collection = std::unordered_set<Sound>;
     using Optional = std::optional<Proxy>;
 
-    Sound(uint8_t number, const char* path, const char* name, bool allow_random);
-    Sound(uint8_t number, String path, const char* name, bool allow_random);
-    Sound(uint8_t number, const char* path, String name, bool allow_random);
-    Sound(uint8_t number, String path, String name, bool allow_random);
+    Sound(uint32_t number, const char* path, const char* name, bool allow_random);
+    Sound(uint32_t number, String path, const char* name, bool allow_random);
+    Sound(uint32_t number, const char* path, String name, bool allow_random);
+    Sound(uint32_t number, String path, String name, bool allow_random);
     // needed for unordered_set
     bool operator==(const Sound& other) const { return number == other.number; }
 
-    uint8_t number;
+    uint32_t number;
     String path;
     String name;
     bool allow_random;
 
 
     /**
-     * Sound proxy for using RAII to automatically write attribute changes to the config file;
+     * View of a managed sound, which locks the sound manager while it exists;
+     * the strings returned point into the sound table, so no strings are copied for accessing a sound.
+     * Changes are applied and journaled immediately;
      * instances of this class must not be stored but only be used as temporary objects
      */
     class Proxy
     {
         SoundManager& m_sound_manager;
+        std::unique_lock<std::mutex> m_lock;
+        size_t m_row;
 
     public:
-        Proxy(const Sound& sound, SoundManager& sound_manager) noexcept;
+        Proxy(SoundManager& sound_manager, std::unique_lock<std::mutex>&& lock, size_t row) noexcept;
         // don't allow copying
         Proxy(Proxy&) = delete;
         // allow moving for use as with optional
         Proxy(Proxy&&) = delete;
 
-        /**
-         * Destructor checks the proxied sound for changes and updates the config file if necessary
-         */
-        ~Proxy();
-
         //! The sound number
-        const uint8_t number;
+        [[nodiscard]] uint32_t number() const;
         //! Whether this sound is eligible to be played randomly
-        bool allow_random;
-        //! the display name of the sound
-        String name;
-        //! The path to the sound's MP3 file
-        String path;
+        [[nodiscard]] bool allowRandom() const;
+        //! The display name of the sound; valid until the proxy is destroyed or the sound is changed
+        [[nodiscard]] const char* name() const;
+        //! The path to the sound's MP3 file; valid until the proxy is destroyed or the sound is changed
+        [[nodiscard]] const char* path() const;
+        //! The title read from the ID3 tag of the sound's file; valid until the proxy is destroyed or the sound is changed
+        [[nodiscard]] const char* title() const;
+        //! The audio properties read from the sound's file
+        [[nodiscard]] const SoundTable::Metadata& metadata() const;
+
+        void setAllowRandom(bool allow_random);
+        void setName(const char* name);
+        void setPath(const char* path);
     };
 };
 
@@ -79,7 +100,7 @@ public:
 template <>
 struct std::hash<Sound>
 {
-    size_t operator()(const Sound& sound) const noexcept { return std::hash<uint8_t>()(sound.number); }
+    size_t operator()(const Sound& sound) const noexcept { return std::hash<uint32_t>()(sound.number); }
 };
 
 // JSON converter specialization for converting sounds from and to JSON
@@ -91,12 +112,23 @@ struct ArduinoJson::Converter<Sound>
     static bool checkJson(JsonVariantConst src);
 };
 
+// JSON converter specialization for writing the sounds of a sound table to JSON
+template <>
+struct ArduinoJson::Converter<SoundTable::View>
+{
+    static void toJson(const SoundTable::View& src, JsonVariant dst);
+};
+
 
 /**
  * Class for managing sounds stored on the SD card
- * and a corresponding configuration file specifying sound attributes;
- * its boot process tries to load the sound configuration from a file
- * or else generates the configuration
+ * and a corresponding binary index file specifying sound attributes (see SoundIndex);
+ * its boot process tries to load the sound index, else imports a JSON sound configuration
+ * or else starts generating the index by scanning the SD card in the background (see SoundIndexer);
+ * a loaded index is updated by rescanning the directories changed since the last scan
+ *
+ * Changes of single sounds are appended to a journal next to the index (see SoundJournal),
+ * which is folded into the index in the background once it exceeds SOUND_JOURNAL_COMPACT_SIZE
  */
 class SoundManager final : BootProcess
 {
@@ -106,51 +138,134 @@ class SoundManager final : BootProcess
 public:
     /**
      * Constructor
-     * @param config_file The path to the sound configuration file
+     * @param index_file The path to the binary sound index file
+     * @param json_file The path to the JSON sound configuration file imported if the index file is missing
      */
-    explicit SoundManager(const char* config_file);
+    SoundManager(const char* index_file, const char* json_file);
+    ~SoundManager() override;
     /**
-     * Stores the sound attributes held by the underlying collection
+     * Stores the sound attributes held by the underlying sound table to the index file
+     * and discards the journaled changes contained
      */
     void store() const;
+    /**
+     * Starts scanning the SD card in the background for sounds added, changed or removed since the last scan
+     */
+    void rescan();
+    /**
+     * Exports the sound attributes held by the underlying sound table as a JSON file
+     * @param path The path of the JSON file to write
+     */
+    void exportJson(const char* path) const;
+    /**
+     * Streams the sound attributes held by the underlying sound table as a JSON array,
+     * holding only a single sound in a JSON document at a time
+     * @param out The Print to write to
+     * @return The number of bytes written
+     */
+    size_t exportJson(Print& out) const;
+    /**
+     * Replaces the managed sounds with the contents of a JSON file and stores them to the index file
+     * @param path The path of the JSON file to read
+     * @return true if the file existed and was imported
+     */
+    bool importJson(const char* path);
     /**
      * Gets an accessor to a requested sound
      * or to a random sound if the number equals 0
      * @param number The sound id number to access; 0 for getting a random sound
-     * @return An optional accessor to the requested sound
-     *         that will automatically write changes performed to the sound when going out of scope
+     * @return An optional accessor to the requested sound, locking the sound manager while it exists,
      *         or an empty optional if the requested sound wasn't found
      *         or no sound could be randomly selected
-     * @note A sound is eligible for random selection if its 'allow_random' flag is set to true
-     *       and wasn't yet selected in the current selection cycle,
+     * @note A sound is eligible for random selection if its 'allow_random' flag is set to true;
+     *       the sounds are drawn from a shuffled deck (see SoundDeck),
      *       resulting in all possible sounds being selected once without any double occurrence
      */
-    Optional operator[](uint8_t number);
+    Optional operator[](uint32_t number);
+    /**
+     * Gets an accessor to the sound the next random selection yields without drawing it from the deck,
+     * e.g., for preparing an alarm whose random sound is only drawn when it triggers
+     * @return An optional accessor to the sound, locking the sound manager while it exists,
+     *         or an empty optional if no sound is eligible for random selection
+     */
+    Optional peekRandom();
     /**
      * Gets the number of managed sounds
-     * @return The size of the underlying sound collection
+     * @return The size of the underlying sound table
      */
-    [[nodiscard]] size_t size() const { return m_sounds.size(); }
+    [[nodiscard]] size_t size() const;
     /**
-     * Gets the collection of the sounds managed
-     * @return An unmodifiable reference to the underlying sound collection
+     * Visits a page of the managed sounds in the order of their numbers,
+     * holding the sound manager locked while visiting
+     * @param offset The number of matching sounds to skip
+     * @param limit The maximum number of sounds to visit
+     * @param filter Case-insensitive substring the sound names must contain; nullptr or empty for all sounds
+     * @param visit Function called with each sound of the page and its position among the matching sounds
+     * @return The total number of matching sounds
      */
-    [[nodiscard]] const Collection& getSounds() const { return m_sounds; }
+    size_t list(size_t offset, size_t limit, const char* filter,
+                const std::function<void(const SoundTable::View&, size_t)>& visit) const;
     /**
-     * Overwrites the collection of managed sounds
-     * @param sounds The sound collection to overwrite the current one with
+     * Overwrites the managed sounds
+     * @param sounds The sound collection to overwrite the current sounds with
      */
     void setSounds(const Collection& sounds);
+    /**
+     * Updates the attributes of a managed sound and appends the change to the journal
+     * @param sound The sound holding the new attributes
+     */
     void setSound(const Sound& sound);
+    /**
+     * Adds a new sound, numbered by a hash of its path, or updates the metadata of the sound with the same path
+     * if its file changed; the number of a sound thus stays the same when the index is regenerated
+     * @param path The path of the sound's file
+     * @param name The display name of the sound
+     * @param title The title read from the sound's file
+     * @param metadata The audio properties read from the sound's file
+     * @return true if the sound was added or updated
+     */
+    bool addSound(const char* path, const String& name, const char* title = nullptr,
+                  const SoundTable::Metadata& metadata = {});
+    /**
+     * Checks whether a sound's file is unchanged since its metadata was read
+     * @param path The path of the sound's file
+     * @param fingerprint The current fingerprint of the file
+     * @return true if a sound with the path and fingerprint exists
+     */
+    [[nodiscard]] bool hasFile(const char* path, uint32_t fingerprint) const;
+    /**
+     * Removes the sounds of a directory and its subdirectories whose files no longer exist
+     * @param dir The path of the directory
+     * @param entries The sorted names of the files and subdirectories the directory contains
+     * @return The number of removed sounds
+     */
+    size_t retainSounds(const String& dir, const std::vector<String>& entries);
 
 private:
+    friend class Sound::Proxy;
+
+    // consecutive numbers tried for a path whose hash collides with another sound's
+    static constexpr uint32_t c_number_probes = 8;
+
     void runBootProcess() override;
-    Optional selectRandom();
-    std::optional<const Sound> trySelectRandom();
-    inline Optional makeProxy(const Sound& sound);
+    size_t findPath(const char* path, uint32_t& free_number) const;
+    void checkNumbers();
+    bool apply(const Sound& sound);
+    void journal(size_t row);
+    size_t selectRandom();
 
-    const char* m_config_file;
-    Collection m_sounds{};
+    const char* m_index_file;
+    const char* m_json_file;
+    SoundTable m_sounds{};
+    SoundDeck m_deck{"sound_deck"};
+    std::unique_ptr<SoundJournal> m_journal;
+    std::unique_ptr<SoundIndexer> m_indexer;
+    // guards the table and the journal against concurrent access by proxies, the indexer and the compaction
+    mutable std::mutex m_mutex{};
+    mutable std::mutex m_store_mutex{};
+    Timer m_compaction_timer{"sound compaction"};
+    // whether sounds were imported with numbers not derived from their paths, which are thus searched linearly
+    bool m_unhashed{false};
 };
 
 
@@ -0,0 +1,269 @@
+#include "sound_table.h"
+
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include "log.h"
+
+
+/**
+ * Computes the largest arena size, which must stay addressable by the offsets and fit into the size type;
+ * it is computed in 64 bits, as 32-bit offsets address one byte more than a 32-bit size_t can count
+ * @tparam Size The size type of the target
+ */
+template <typename Size>
+static constexpr Size arena_max()
+{
+    return static_cast<Size>(std::min<uint64_t>(static_cast<uint64_t>(std::numeric_limits<SoundTable::offset_t>::max()) + 1,
+                                                std::numeric_limits<Size>::max()));
+}
+
+// checked for both widths of size_t, so a host build covers the 32-bit target
+static_assert(arena_max<uint32_t>() > 0 && arena_max<uint64_t>() > 0, "The arena size must not wrap around");
+static constexpr size_t c_arena_max = arena_max<size_t>();
+static constexpr size_t c_arena_initial = 64;
+
+
+/**
+ * Resizes an arena allocation, preferring PSRAM if enabled
+ * @param arena The current allocation or nullptr
+ * @param size The new size
+ * @return The resized allocation or nullptr on failure, leaving the current allocation valid
+ */
+static char* reallocate(char* arena, size_t size)
+{
+#if SOUND_TABLE_USE_PSRAM
+    if (auto* moved = heap_caps_realloc(arena, size, MALLOC_CAP_SPIRAM))
+        return static_cast<char*>(moved);
+#endif
+    return static_cast<char*>(heap_caps_realloc(arena, size, MALLOC_CAP_DEFAULT));
+}
+
+
+SoundTable::SoundTable()
+{
+    clear();
+}
+
+SoundTable::~SoundTable()
+{
+    heap_caps_free(m_arena);
+}
+
+SoundTable::SoundTable(const SoundTable& other) :
+    m_rows(other.m_rows)
+{
+    // copies are only taken for writing the table, so the arena is copied without its unused capacity
+    if (grow(other.m_arena_size))
+    {
+        memcpy(m_arena, other.m_arena, other.m_arena_size);
+        m_arena_size = other.m_arena_size;
+        m_garbage = other.m_garbage;
+    }
+    else
+    {
+        m_rows.clear();
+        clear();
+    }
+}
+
+SoundTable& SoundTable::operator=(const SoundTable& other)
+{
+    if (this != &other)
+    {
+        SoundTable copy{other};
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+SoundTable::SoundTable(SoundTable&& other) noexcept :
+    m_rows(std::move(other.m_rows)),
+    m_arena(std::exchange(other.m_arena, nullptr)),
+    m_arena_size(std::exchange(other.m_arena_size, 0)),
+    m_arena_capacity(std::exchange(other.m_arena_capacity, 0)),
+    m_garbage(std::exchange(other.m_garbage, 0)) {}
+
+SoundTable& SoundTable::operator=(SoundTable&& other) noexcept
+{
+    std::swap(m_rows, other.m_rows);
+    std::swap(m_arena, other.m_arena);
+    std::swap(m_arena_size, other.m_arena_size);
+    std::swap(m_arena_capacity, other.m_arena_capacity);
+    std::swap(m_garbage, other.m_garbage);
+    return *this;
+}
+
+void SoundTable::clear()
+{
+    m_rows.clear();
+    m_garbage = 0;
+    // offset 0 always holds the empty string, which is shared by all rows with an empty string
+    m_arena_size = 0;
+    if (grow(c_arena_initial))
+    {
+        m_arena[0] = '\0';
+        m_arena_size = 1;
+    }
+}
+
+void SoundTable::reserve(size_t rows, size_t strings)
+{
+    m_rows.reserve(rows);
+    grow(m_arena_size + strings);
+}
+
+size_t SoundTable::insert(uint32_t number, const char* path, const char* name, bool allow_random,
+                          const char* title, const Metadata& metadata)
+{
+    auto it = std::ranges::lower_bound(m_rows, number, {}, &Row::number);
+    if (it != m_rows.end() && it->number == number)
+        return npos;
+
+    Row row{.number = number, .path = 0, .name = 0, .title = 0, .metadata = metadata, .flags = static_cast<uint8_t>(allow_random ? c_allow_random : 0)};
+    auto arena_size = m_arena_size;
+    if (!append(path, row.path) || !append(name, row.name) || !append(title, row.title))
+    {
+        m_arena_size = arena_size;
+        return npos;
+    }
+
+    // the position is taken before inserting, which invalidates the iterators
+    auto pos = static_cast<size_t>(it - m_rows.begin());
+    m_rows.insert(it, row);
+    return pos;
+}
+
+void SoundTable::erase(size_t row)
+{
+    for (auto offset : {m_rows[row].path, m_rows[row].name, m_rows[row].title})
+        m_garbage += offset ? strlen(m_arena + offset) + 1 : 0;
+    m_rows.erase(m_rows.begin() + row);
+    if (m_garbage > m_arena_size / 2)
+        compact();
+}
+
+size_t SoundTable::find(uint32_t number) const
+{
+    auto it = std::ranges::lower_bound(m_rows, number, {}, &Row::number);
+    return it != m_rows.end() && it->number == number ? it - m_rows.begin() : npos;
+}
+
+bool SoundTable::setPath(size_t row, const char* path)
+{
+    return replace(m_rows[row].path, path);
+}
+
+bool SoundTable::setName(size_t row, const char* name)
+{
+    return replace(m_rows[row].name, name);
+}
+
+bool SoundTable::setMetadata(size_t row, const char* title, const Metadata& metadata)
+{
+    m_rows[row].metadata = metadata;
+    return replace(m_rows[row].title, title);
+}
+
+void SoundTable::setFlag(size_t row, uint8_t flag, bool set)
+{
+    if (set)
+        m_rows[row].flags |= flag;
+    else
+        m_rows[row].flags &= ~flag;
+}
+
+bool SoundTable::append(const char* str, offset_t& offset)
+{
+    if (!str || !*str)
+    {
+        offset = 0;
+        return true;
+    }
+
+    auto length = strlen(str) + 1;
+    if (m_arena_size + length > m_arena_capacity)
+    {
+        // the string may be taken from the arena itself, which is moved by growing it
+        auto inside = str >= m_arena && str < m_arena + m_arena_size;
+        auto at = str - m_arena;
+        grow(std::max(m_arena_capacity * 2, m_arena_size + length));
+        if (inside)
+            str = m_arena + at;
+    }
+    if (m_arena_size + length > m_arena_capacity)
+    {
+        LOG_E("Sound table arena is full, cannot add \"%s\"", str);
+        return false;
+    }
+
+    memcpy(m_arena + m_arena_size, str, length);
+    offset = static_cast<offset_t>(m_arena_size);
+    m_arena_size += length;
+    return true;
+}
+
+bool SoundTable::replace(offset_t& offset, const char* str)
+{
+    auto* current = m_arena + offset;
+    if (strcmp(current, str ? str : "") == 0)
+        return true;
+
+    auto replaced = offset ? strlen(current) + 1 : 0;
+    if (!append(str, offset))
+        return false;
+
+    m_garbage += replaced;
+    if (m_garbage > m_arena_size / 2)
+        compact();
+    return true;
+}
+
+bool SoundTable::grow(size_t capacity)
+{
+    capacity = std::min(capacity, c_arena_max);
+    if (capacity <= m_arena_capacity)
+        return m_arena_capacity > 0;
+
+    auto* arena = reallocate(m_arena, capacity);
+    if (!arena)
+        return false;
+
+    m_arena = arena;
+    m_arena_capacity = capacity;
+    return true;
+}
+
+void SoundTable::compact()
+{
+    auto capacity = m_arena_size - m_garbage;
+    auto* arena = reallocate(nullptr, capacity);
+    if (!arena)
+        return;
+
+    // copy the strings row by row; shared empty strings stay at offset 0
+    arena[0] = '\0';
+    size_t size = 1;
+    auto move = [&](offset_t& offset)
+    {
+        if (offset == 0)
+            return;
+        auto length = strlen(m_arena + offset) + 1;
+        memcpy(arena + size, m_arena + offset, length);
+        offset = static_cast<offset_t>(size);
+        size += length;
+    };
+    for (auto& row : m_rows)
+    {
+        move(row.path);
+        move(row.name);
+        move(row.title);
+    }
+
+    heap_caps_free(m_arena);
+    m_arena = arena;
+    m_arena_size = size;
+    m_arena_capacity = capacity;
+    m_garbage = 0;
+}
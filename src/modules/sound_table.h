@@ -0,0 +1,205 @@
+#ifndef SOUND_TABLE_H
+#define SOUND_TABLE_H
+
+#include <Arduino.h>
+#include <iterator>
+#include <vector>
+
+#ifndef SOUND_TABLE_OFFSET_T
+// type of the string offsets, limiting the size of the string arena;
+// 16-bit offsets save 4 bytes per sound but limit the strings of all sounds to 64 KiB (about a thousand sounds)
+#define SOUND_TABLE_OFFSET_T uint32_t
+#endif
+
+#ifndef SOUND_TABLE_USE_PSRAM
+// whether the string arena should be allocated in PSRAM if available
+#define SOUND_TABLE_USE_PSRAM 1
+#endif
+
+
+/**
+ * Compact table of sounds, consisting of fixed-size rows sorted by sound number
+ * and a single arena holding the null-terminated strings of all rows, which the rows refer to by offset
+ *
+ * Compared to a hash set of sounds each owning two heap allocated strings, the table needs two allocations in total
+ * and no per-sound allocation overhead; as the rows hold offsets instead of pointers,
+ * the arena can grow (and be moved into PSRAM) without updating the rows.
+ * A sound is found by binary search on its number.
+ *
+ * Replacing a string appends the new string to the arena; the arena is compacted
+ * once the replaced strings take up half of it.
+ * Pointers returned by path() and name() are invalidated by any modification of the table
+ */
+class SoundTable
+{
+public:
+    using offset_t = SOUND_TABLE_OFFSET_T;
+    //! Row index returned if a sound could not be found
+    static constexpr size_t npos = SIZE_MAX;
+
+    /**
+     * Audio properties of a sound's file; all zero if unknown
+     */
+    struct Metadata
+    {
+        uint32_t duration_ms;
+        uint16_t sample_rate;
+        //! The average bitrate in kbit/s
+        uint16_t bitrate;
+        //! Hash of the name, size and modification time of the file the properties were read from
+        uint32_t fingerprint;
+    };
+
+    /**
+     * Value of a row with its strings resolved
+     */
+    struct View
+    {
+        uint32_t number;
+        const char* path;
+        const char* name;
+        bool allow_random;
+        const char* title;
+        Metadata metadata;
+    };
+
+    /**
+     * Iterator over the rows of the table, dereferencing to a View
+     */
+    class Iterator
+    {
+        const SoundTable* m_table;
+        size_t m_row;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = View;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = View;
+
+        Iterator(const SoundTable* table, size_t row) : m_table(table), m_row(row) {}
+        View operator*() const { return m_table->view(m_row); }
+        Iterator& operator++() { ++m_row; return *this; }
+        Iterator operator++(int) { auto it = *this; ++m_row; return it; }
+        bool operator==(const Iterator& other) const = default;
+    };
+
+    SoundTable();
+    ~SoundTable();
+    SoundTable(const SoundTable& other);
+    SoundTable& operator=(const SoundTable& other);
+    SoundTable(SoundTable&& other) noexcept;
+    SoundTable& operator=(SoundTable&& other) noexcept;
+
+    /**
+     * Removes all rows
+     */
+    void clear();
+
+    /**
+     * Reserves memory for the given number of rows and string bytes
+     * @param rows The number of rows to reserve
+     * @param strings The number of string bytes to reserve, including the terminators
+     */
+    void reserve(size_t rows, size_t strings);
+
+    /**
+     * Inserts a new row, keeping the rows sorted
+     * @param number The sound number
+     * @param path The path of the sound's file
+     * @param name The display name of the sound
+     * @param allow_random Whether the sound may be selected randomly
+     * @param title The title of the sound read from its file's tags
+     * @param metadata The audio properties of the sound's file
+     * @return The index of the inserted row or npos if the number already exists or the arena is full
+     */
+    size_t insert(uint32_t number, const char* path, const char* name, bool allow_random,
+                  const char* title = nullptr, const Metadata& metadata = {});
+
+    /**
+     * Removes a row
+     * @param row The index of the row to remove
+     */
+    void erase(size_t row);
+
+    /**
+     * Finds the row of a sound
+     * @param number The sound number
+     * @return The row index or npos if no such sound exists
+     */
+    [[nodiscard]] size_t find(uint32_t number) const;
+
+    [[nodiscard]] size_t size() const { return m_rows.size(); }
+    [[nodiscard]] bool empty() const { return m_rows.empty(); }
+    [[nodiscard]] uint32_t number(size_t row) const { return m_rows[row].number; }
+    [[nodiscard]] const char* path(size_t row) const { return m_arena + m_rows[row].path; }
+    [[nodiscard]] const char* name(size_t row) const { return m_arena + m_rows[row].name; }
+    [[nodiscard]] bool allowRandom(size_t row) const { return m_rows[row].flags & c_allow_random; }
+    [[nodiscard]] const char* title(size_t row) const { return m_arena + m_rows[row].title; }
+    [[nodiscard]] const Metadata& metadata(size_t row) const { return m_rows[row].metadata; }
+    [[nodiscard]] View view(size_t row) const
+    {
+        return {number(row), path(row), name(row), allowRandom(row), title(row), metadata(row)};
+    }
+
+    /**
+     * Replaces the path of a row
+     * @return false if the arena is full
+     */
+    bool setPath(size_t row, const char* path);
+
+    /**
+     * Replaces the name of a row
+     * @return false if the arena is full
+     */
+    bool setName(size_t row, const char* name);
+
+    void setAllowRandom(size_t row, bool allow_random) { setFlag(row, c_allow_random, allow_random); }
+
+    /**
+     * Replaces the properties read from the file of a row
+     * @return false if the arena is full
+     */
+    bool setMetadata(size_t row, const char* title, const Metadata& metadata);
+
+    [[nodiscard]] Iterator begin() const { return {this, 0}; }
+    [[nodiscard]] Iterator end() const { return {this, m_rows.size()}; }
+
+    /**
+     * Get the number of heap bytes held by the table
+     */
+    [[nodiscard]] size_t memoryUsage() const { return m_rows.capacity() * sizeof(Row) + m_arena_capacity; }
+
+private:
+    // loads the rows and the arena directly from an index file
+    friend class SoundIndex;
+
+    static constexpr uint8_t c_allow_random = 0x01;
+
+    struct Row
+    {
+        uint32_t number;
+        offset_t path;
+        offset_t name;
+        offset_t title;
+        Metadata metadata;
+        uint8_t flags;
+    };
+
+    void setFlag(size_t row, uint8_t flag, bool set);
+    bool append(const char* str, offset_t& offset);
+    bool replace(offset_t& offset, const char* str);
+    bool grow(size_t capacity);
+    void compact();
+
+    std::vector<Row> m_rows{};
+    char* m_arena{};
+    size_t m_arena_size{};
+    size_t m_arena_capacity{};
+    // bytes of strings that were replaced
+    size_t m_garbage{};
+};
+
+
+#endif //SOUND_TABLE_H
@@ -63,7 +63,7 @@ private:
     const std::vector<muif_struct> m_fields;
     U8G2 m_display;
     MUIU8G2 m_ui{};
-    Timer m_close_timer;
+    Timer m_close_timer{"ui close"};
 };
 
 
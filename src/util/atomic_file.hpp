@@ -0,0 +1,85 @@
+#ifndef ATOMIC_FILE_HPP
+#define ATOMIC_FILE_HPP
+
+#include <FS.h>
+#include <functional>
+#include "log.h"
+
+
+/**
+ * Helpers for replacing files without leaving a partially written file behind on power loss;
+ * the new contents are written into a temporary file next to the target, which replaces the target once complete
+ */
+namespace atomic_file
+{
+    /**
+     * Get the path of the temporary file used for replacing a file
+     * @param path The path of the target file
+     */
+    inline String tmpPath(const char* path) { return String(path) + ".tmp"; }
+
+    /**
+     * Resolves an interrupted replacement of a file; must be called before reading the file
+     * @param fs The filesystem of the file
+     * @param path The path of the target file
+     */
+    inline void recover(FS& fs, const char* path)
+    {
+        auto tmp = tmpPath(path);
+        if (!fs.exists(tmp))
+            return;
+
+        // a leftover temporary file is only complete if the target was already removed
+        if (fs.exists(path))
+        {
+            LOG_W("Discarding incomplete write of %s", path);
+            fs.remove(tmp);
+        }
+        else
+        {
+            LOG_W("Recovering %s from completed write", path);
+            fs.rename(tmp.c_str(), path);
+        }
+    }
+
+    /**
+     * Replaces the contents of a file; the previous contents are kept if writing fails
+     * @param fs The filesystem of the file
+     * @param path The path of the target file
+     * @param write Function writing the new contents to the given file; returns false on failure
+     * @return true if the file was replaced
+     */
+    inline bool replace(FS& fs, const char* path, const std::function<bool(File&)>& write)
+    {
+        auto tmp = tmpPath(path);
+
+        // on ESP32, FILE_WRITE will overwrite existing contents
+        auto file = fs.open(tmp, FILE_WRITE);
+        if (!file)
+        {
+            LOG_E("Failed to open %s for writing", tmp.c_str());
+            return false;
+        }
+        auto ok = write(file);
+        file.close();
+
+        if (!ok)
+        {
+            LOG_E("Failed to write %s, keeping the previous contents", path);
+            fs.remove(tmp);
+            return false;
+        }
+
+        // FAT cannot rename onto an existing file; a power loss in between is resolved by recover()
+        fs.remove(path);
+        if (!fs.rename(tmp.c_str(), path))
+        {
+            LOG_E("Failed to replace %s", path);
+            return false;
+        }
+        return true;
+    }
+}
+
+
+#endif //ATOMIC_FILE_HPP
@@ -3,6 +3,11 @@
 
 #include <ESPAsyncWebServer.h>
 #include <AsyncJson.h>
+#include <span>
+
+#ifndef ENDPOINT_MAX_BODY_SIZE
+#define ENDPOINT_MAX_BODY_SIZE 8192
+#endif
 
 
 namespace endpoint
@@ -25,10 +30,10 @@ namespace endpoint
     template <typename T>
     concept is_setter = std::is_reference_v<T> && !std::is_const_v<std::remove_reference_t<T>>;
 
-    template <typename Request, typename JRequest, typename T>
+    template <typename Request, typename JRequest, typename BRequest, typename T>
     concept is_valid_endpoint_arg =
         is_plain<T> || is_json<T> ||
-        is_func<Request, T> || is_func<JRequest, T> ||
+        is_func<Request, T> || is_func<JRequest, T> || is_func<BRequest, T> ||
         is_getter<T> || is_setter<T>;
 
     /**
@@ -45,6 +50,7 @@ namespace endpoint
     public:
         class Request;
         class JRequest;
+        class BRequest;
 
     private:
         /**
@@ -157,6 +163,7 @@ namespace endpoint
              * the type of the endpoint handler depends on the arg type:
              *  - if the arg is a PlainHandlerFunc or ArRequestHandlerFunction, a AsyncCallbackWebHandler is created
              *  - if the arg is a JsonHandlerFunc or ArJsonRequestHandlerFunction, a AsyncCallbackJsonWebHandler is created
+             *  - if the arg is a function taking a BRequest, a AsyncCallbackWebHandler collecting the raw body is created
              *  - if the arg is a const reference, a JSON getter is created
              *  - if the arg is a non-const reference, a JSON setter is created
              * @tparam Arg The argument type; must be either the callback type for a
@@ -165,7 +172,7 @@ namespace endpoint
              * @param arg The handler argument to construct the endpoint handler from
              * @return The created Endpoint instance
              */
-            template <typename Arg> requires is_valid_endpoint_arg<Request, JRequest, Arg>
+            template <typename Arg> requires is_valid_endpoint_arg<Request, JRequest, BRequest, Arg>
             Endpoint build(Arg&& arg) const;
 
             /**
@@ -294,6 +301,16 @@ namespace endpoint
             explicit JRequest(AsyncWebServerRequest* request, JsonVariant& json) : Request(request), payload(json) {}
         };
 
+        /**
+         * Helper class wrapping a request with a raw binary payload of at most ENDPOINT_MAX_BODY_SIZE bytes
+         */
+        class BRequest : public Request
+        {
+        public:
+            std::span<const uint8_t> body;
+            explicit BRequest(AsyncWebServerRequest* request, std::span<const uint8_t> data) : Request(request), body(data) {}
+        };
+
 
         // delete copy construction
         Endpoint(Endpoint&) = delete;
@@ -305,6 +322,7 @@ namespace endpoint
 
     using Request = Endpoint::Request;
     using JRequest = Endpoint::JRequest;
+    using BRequest = Endpoint::BRequest;
 }
 
 
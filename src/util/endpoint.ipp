@@ -84,7 +84,7 @@ namespace endpoint
         return *this;
     }
 
-    template <typename Arg> requires is_valid_endpoint_arg<Endpoint::Request, Endpoint::JRequest, Arg>
+    template <typename Arg> requires is_valid_endpoint_arg<Endpoint::Request, Endpoint::JRequest, Endpoint::BRequest, Arg>
     Endpoint Endpoint::Builder::build(Arg&& arg) const
     {
         if constexpr (is_plain<Arg>)
@@ -120,6 +120,34 @@ namespace endpoint
                 arg(request);
             });
         }
+        else if constexpr (is_func<BRequest, Arg>)
+        {
+            // the created handler will be owned by the server, which will handle deletion
+            auto handler = new HandlerWrapper<AsyncCallbackWebHandler>();
+            (*handler)->setUri(_uri);
+            (*handler)->setMethod(_method);
+            (*handler)->onBody([](AsyncWebServerRequest* r, uint8_t* data, size_t len, size_t index, size_t total)
+            {
+                // the body is collected in the request's temporary object, which is freed by the request
+                if (total > ENDPOINT_MAX_BODY_SIZE)
+                    return;
+                if (index == 0 && !r->_tempObject)
+                    r->_tempObject = malloc(total);
+                if (r->_tempObject)
+                    memcpy(static_cast<uint8_t*>(r->_tempObject) + index, data, len);
+            });
+            (*handler)->onRequest([arg](AsyncWebServerRequest* r)
+            {
+                if (!r->_tempObject)
+                {
+                    r->send(r->contentLength() > ENDPOINT_MAX_BODY_SIZE ? 413 /*Content Too Large*/ : 400 /*Bad Request*/);
+                    return;
+                }
+                BRequest request{r, {static_cast<const uint8_t*>(r->_tempObject), r->contentLength()}};
+                arg(request);
+            });
+            return handler;
+        }
         else if constexpr (is_getter<Arg>)
         {
             return build([&arg](AsyncWebServerRequest* r)
@@ -0,0 +1,190 @@
+#include "hires_timer.h"
+
+#include "log.h"
+
+
+HiResTimer::HiResTimer(const char* name, Dispatch dispatch) : m_name(name), m_dispatch(dispatch) {}
+
+HiResTimer::~HiResTimer()
+{
+    if (m_timer)
+    {
+        esp_timer_stop(m_timer);
+        esp_timer_delete(m_timer);
+    }
+}
+
+bool HiResTimer::once(duration_t period, const callback_t& callback, bool start)
+{
+    return create(period, callback, nullptr, nullptr, false, start);
+}
+
+bool HiResTimer::once(duration_t period, function_t function, void* arg, bool start)
+{
+    return create(period, nullptr, function, arg, false, start);
+}
+
+bool HiResTimer::always(duration_t period, const callback_t& callback, bool start)
+{
+    return create(period, callback, nullptr, nullptr, true, start);
+}
+
+bool HiResTimer::always(duration_t period, function_t function, void* arg, bool start)
+{
+    return create(period, nullptr, function, arg, true, start);
+}
+
+void HiResTimer::stop() const
+{
+    if (m_timer)
+    {
+        esp_timer_stop(m_timer);
+    }
+}
+
+void HiResTimer::start()
+{
+    if (m_timer && !esp_timer_is_active(m_timer))
+    {
+        startTimer();
+    }
+}
+
+void HiResTimer::reset()
+{
+    if (m_timer)
+    {
+        esp_timer_stop(m_timer);
+        startTimer();
+    }
+}
+
+void HiResTimer::changePeriod(duration_t period)
+{
+    m_period_us = period.count();
+    if (m_timer && esp_timer_is_active(m_timer))
+    {
+        esp_timer_stop(m_timer);
+        startTimer();
+    }
+}
+
+void HiResTimer::setReload(bool reload)
+{
+    m_reload = reload;
+}
+
+HiResTimer::Stats HiResTimer::stats() const
+{
+    portENTER_CRITICAL(&m_stats_lock);
+    auto stats = m_stats;
+    portEXIT_CRITICAL(&m_stats_lock);
+    return stats;
+}
+
+void HiResTimer::s_callback(void* arg)
+{
+    auto* self = static_cast<HiResTimer*>(arg);
+    self->fired();
+
+    if (self->m_function)
+        self->m_function(self->m_arg);
+    else if (self->m_callback)
+        self->m_callback();
+}
+
+void IRAM_ATTR HiResTimer::s_isr_callback(void* arg)
+{
+    // neither std::function nor any other code in flash may be called here
+    auto* self = static_cast<HiResTimer*>(arg);
+    self->fired();
+
+    if (self->m_function)
+        self->m_function(self->m_arg);
+}
+
+void IRAM_ATTR HiResTimer::fired()
+{
+    auto now = esp_timer_get_time();
+    auto lateness = now - m_due_us;
+
+    portENTER_CRITICAL_SAFE(&m_stats_lock);
+    ++m_stats.fired;
+    m_stats.total_lateness_us += lateness;
+    if (lateness > m_stats.max_lateness_us)
+        m_stats.max_lateness_us = lateness;
+    portEXIT_CRITICAL_SAFE(&m_stats_lock);
+
+    // periodic esp_timers are scheduled relative to their previous alarm, not to the callback execution;
+    // as unhandled events are skipped, esp_timer reschedules a timer that missed more than one period relative to now
+    auto period = static_cast<int64_t>(m_period_us);
+    if (period > 0 && lateness / period > 1)
+        m_due_us = now + period;
+    else
+        m_due_us += period;
+}
+
+bool HiResTimer::create(duration_t period, const callback_t& callback, function_t function, void* arg, bool reload,
+                        bool start)
+{
+    if (callback && m_dispatch == Dispatch::isr)
+    {
+        LOG_E("Timer %s is dispatched in the ISR, which can't call a std::function", m_name ? m_name : "<unnamed>");
+        return false;
+    }
+
+#if !CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+    if (m_dispatch == Dispatch::isr)
+    {
+        // falling back to the esp_timer task would silently break the timing the caller asked for
+        LOG_E("Timer %s is dispatched in the ISR, which is not supported by this esp_timer configuration",
+              m_name ? m_name : "<unnamed>");
+        return false;
+    }
+#endif
+
+    if (!m_timer)
+    {
+        esp_timer_create_args_t args{
+            .callback = m_dispatch == Dispatch::isr ? s_isr_callback : s_callback,
+            .arg = this,
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+            .dispatch_method = m_dispatch == Dispatch::isr ? ESP_TIMER_ISR : ESP_TIMER_TASK,
+#else
+            .dispatch_method = ESP_TIMER_TASK,
+#endif
+            .name = m_name,
+            .skip_unhandled_events = true,
+        };
+        if (esp_timer_create(&args, &m_timer) != ESP_OK)
+        {
+            m_timer = nullptr;
+            return false;
+        }
+    }
+    else
+    {
+        esp_timer_stop(m_timer);
+    }
+
+    m_callback = callback;
+    m_function = function;
+    m_arg = arg;
+    m_period_us = period.count();
+    m_reload = reload;
+
+    if (start)
+    {
+        startTimer();
+    }
+    return true;
+}
+
+void HiResTimer::startTimer()
+{
+    m_due_us = esp_timer_get_time() + static_cast<int64_t>(m_period_us);
+    if (m_reload)
+        esp_timer_start_periodic(m_timer, m_period_us);
+    else
+        esp_timer_start_once(m_timer, m_period_us);
+}
@@ -0,0 +1,159 @@
+#ifndef HIRES_TIMER_H
+#define HIRES_TIMER_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <chrono>
+#include <functional>
+
+
+/**
+ * High resolution timer class for calling an action after a given period in micro- or milliseconds,
+ * either once or repeating; backed by <code>esp_timer</code> instead of the tick-based FreeRTOS software timers
+ *
+ * Timers dispatched in the ISR only accept a plain function and argument, which must be placed in IRAM,
+ * as the ISR also runs while the flash cache is disabled; they require CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+ *
+ * @note Assigning a new callback stops the timer; a timer must not be reassigned from inside its own callback
+ */
+class HiResTimer
+{
+    using callback_t = std::function<void()>;
+
+public:
+    using duration_t = std::chrono::microseconds;
+    //! Callback taking the argument assigned along with it; must be marked IRAM_ATTR for ISR dispatch
+    using function_t = void (*)(void* arg);
+
+    //! The context the timer callback is executed in
+    enum class Dispatch
+    {
+        //! The callback runs inside the esp_timer task
+        task,
+        //! The callback runs inside the timer ISR; the callback must be ISR safe and placed in IRAM
+        isr,
+    };
+
+    /**
+     * Firing accuracy statistics of a timer
+     */
+    struct Stats
+    {
+        //! The number of times the timer fired
+        uint32_t fired = 0;
+        //! The largest delay of the callback execution behind the scheduled time in µs
+        int64_t max_lateness_us = 0;
+        //! The sum of all delays of the callback execution behind the scheduled time in µs
+        int64_t total_lateness_us = 0;
+    };
+
+    /**
+     * Creates a new timer
+     * @param name The name of the timer, used for debugging
+     * @param dispatch The context the callback should be executed in
+     */
+    explicit HiResTimer(const char* name = nullptr, Dispatch dispatch = Dispatch::task);
+
+    /**
+     * Stops and deletes the timer
+     */
+    ~HiResTimer();
+
+    /**
+     * Assigns a new one-shot callback to this timer
+     * @param period The period after which the timed action should occur
+     * @param callback The callback to run on timer execution
+     * @param start Whether the timer should be started instantly
+     * @return true if the timer was created successfully; false for a timer dispatched in the ISR
+     */
+    bool once(duration_t period, const callback_t& callback, bool start = false);
+
+    /**
+     * Assigns a new one-shot callback to this timer
+     * @param period The period after which the timed action should occur
+     * @param function The function to run on timer execution
+     * @param arg The argument passed to the function
+     * @param start Whether the timer should be started instantly
+     * @return true if the timer was created successfully; false for a timer dispatched in the ISR if not supported
+     */
+    bool once(duration_t period, function_t function, void* arg, bool start = false);
+
+    /**
+     * Assigns a new repeating callback to this timer
+     * @param period The period after which the timed action should occur
+     * @param callback The callback to run on timer execution
+     * @param start Whether the timer should be started instantly
+     * @return true if the timer was created successfully; false for a timer dispatched in the ISR
+     */
+    bool always(duration_t period, const callback_t& callback, bool start = false);
+
+    /**
+     * Assigns a new repeating callback to this timer
+     * @param period The period after which the timed action should occur
+     * @param function The function to run on timer execution
+     * @param arg The argument passed to the function
+     * @param start Whether the timer should be started instantly
+     * @return true if the timer was created successfully; false for a timer dispatched in the ISR if not supported
+     */
+    bool always(duration_t period, function_t function, void* arg, bool start = false);
+
+    /**
+     * Stops the timer (can be restarted)
+     */
+    void stop() const;
+
+    /**
+     * Starts the timer if it is not already running
+     */
+    void start();
+
+    /**
+     * Resets the timer, starting it if not running or resetting the elapsed duration
+     */
+    void reset();
+
+    /**
+     * Change the period of this timer; a running timer is restarted with the new period
+     * @param period The new period
+     */
+    void changePeriod(duration_t period);
+
+    /**
+     * Change the timer type; takes effect the next time the timer is started
+     * @param reload Whether this timer should stop after execution or keep repeating
+     */
+    void setReload(bool reload);
+
+    /**
+     * Get a copy of the firing accuracy statistics of this timer, which are updated by the timer callback
+     */
+    [[nodiscard]] Stats stats() const;
+
+    // delete copy constructor and assignment operator as the timer argument points to the instance
+
+    HiResTimer(const HiResTimer&) = delete;
+    HiResTimer& operator=(const HiResTimer&) = delete;
+
+private:
+    const char* m_name;
+    Dispatch m_dispatch;
+    esp_timer_handle_t m_timer{};
+    callback_t m_callback{};
+    function_t m_function{};
+    void* m_arg{};
+    uint64_t m_period_us{};
+    int64_t m_due_us{};
+    bool m_reload{};
+    Stats m_stats{};
+    // guards the stats against the callback, which might run inside the ISR
+    mutable portMUX_TYPE m_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+    static void s_callback(void* arg);
+    static void s_isr_callback(void* arg);
+    void fired();
+    bool create(duration_t period, const callback_t& callback, function_t function, void* arg, bool reload, bool start);
+    void startTimer();
+};
+
+
+#endif //HIRES_TIMER_H
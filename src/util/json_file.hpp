@@ -3,10 +3,22 @@
 
 #include <ArduinoJson.h>
 #include <SD.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include "log.h"
+#include "atomic_file.hpp"
+
+#ifndef JSON_FILE_WRITE_BUFFER_SIZE
+#define JSON_FILE_WRITE_BUFFER_SIZE 512
+#endif
 
 
 /**
  * Utility class extending a JSON document for reading and writing a JSON file using RAII
+ *
+ * The file is written atomically: the document is serialized through a buffered writer into a temporary file,
+ * which replaces the target only after being written completely; reading recovers the temporary file
+ * if the target was already removed but the temporary file not yet renamed
  */
 class JsonFile : public JsonDocument
 {
@@ -16,6 +28,7 @@ class JsonFile : public JsonDocument
     const char* path_;
     FS& fs_;
     uint8_t op_;
+    bool pretty_{false};
     DeserializationError error_{};
 
     JsonFile(const char* path, FS& fs, uint8_t op): path_(path), fs_(fs), op_(op)
@@ -23,6 +36,8 @@ class JsonFile : public JsonDocument
         // perform reading only if read operation was requested
         if (op_ & op_read)
         {
+            atomic_file::recover(fs_, path_);
+
             if (fs_.exists(path_))
             {
                 if (auto file = fs_.open(path_, FILE_READ))
@@ -39,6 +54,56 @@ class JsonFile : public JsonDocument
     }
 
 public:
+    /**
+     * Print collecting the serialized output in a buffer of a sector's size,
+     * so the file is written in few large chunks instead of one call per token
+     */
+    class BufferedWriter : public Print
+    {
+        File& file_;
+        uint8_t buffer_[JSON_FILE_WRITE_BUFFER_SIZE]{};
+        size_t length_{};
+
+    public:
+        //! The number of writes passed to the file
+        uint32_t writes{};
+        //! Whether all writes succeeded
+        bool ok{true};
+
+        explicit BufferedWriter(File& file) : file_(file) {}
+
+        size_t write(uint8_t c) override
+        {
+            if (length_ == sizeof(buffer_))
+                flush();
+            buffer_[length_++] = c;
+            return 1;
+        }
+
+        size_t write(const uint8_t* data, size_t size) override
+        {
+            for (size_t i = 0; i < size;)
+            {
+                if (length_ == sizeof(buffer_))
+                    flush();
+                auto n = std::min(size - i, sizeof(buffer_) - length_);
+                memcpy(buffer_ + length_, data + i, n);
+                length_ += n;
+                i += n;
+            }
+            return size;
+        }
+
+        void flush() override
+        {
+            if (length_ == 0)
+                return;
+            ok &= file_.write(buffer_, length_) == length_;
+            ++writes;
+            length_ = 0;
+        }
+    };
+
     /**
      * Creates an instance reading a JSON file; changes will not be written
      * @param path The path of the file
@@ -61,20 +126,41 @@ public:
      */
     static JsonFile rw(const char* path, FS& fs = SD) { return {path, fs, op_read | op_write}; }
 
+    /**
+     * Set whether the file should be written indented for readability instead of compact
+     * @param pretty Whether to write pretty JSON
+     * @return A reference to this instance
+     */
+    JsonFile& pretty(bool pretty = true)
+    {
+        pretty_ = pretty;
+        return *this;
+    }
+
     // use destructor to automatically write the JSON document
     // if requested after the instance gets out of scope
     ~JsonFile()
     {
         // perform writing only if write operation was requested
-        if (op_ & op_write)
+        if (!(op_ & op_write))
+            return;
+
+        auto start = esp_timer_get_time();
+        size_t size = 0;
+        uint32_t writes = 0;
+        auto ok = atomic_file::replace(fs_, path_, [&](File& file)
         {
-            // on ESP32, FILE_WRITE will overwrite existing contents
-            auto file = fs_.open(path_, FILE_WRITE);
-            if (file)
-            {
-                serializeJsonPretty(*this, file);
-            }
-            file.close();
+            BufferedWriter writer{file};
+            size = pretty_ ? serializeJsonPretty(*this, writer) : serializeJson(*this, writer);
+            writer.flush();
+            writes = writer.writes;
+            return writer.ok;
+        });
+
+        if (ok)
+        {
+            LOG_D("Wrote %u bytes to %s using %u writes in %lld us",
+                  size, path_, writes, esp_timer_get_time() - start);
         }
     }
 
@@ -2,21 +2,182 @@
 #define NVS_VALUE_HPP
 
 #include <Preferences.h>
+#include <nvs.h>
+#include <esp_system.h>
+#include <esp_timer.h>
 #include "log.h"
+#include "timer.h"
+#include "snapshot.hpp"
 #include <unordered_set>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <concepts>
+#include <algorithm>
+#include <utility>
+#include <optional>
+#include <cassert>
+#include <cinttypes>
+
+#ifndef NVS_COMMIT_DELAY
+#define NVS_COMMIT_DELAY 2
+#endif
 
 
 /*!
- * @brief Abstract class for storing values in the non-volatile storage (NVS) using the Preferences API
+ * @brief Abstract class for storing values in the non-volatile storage (NVS); values are read using the Preferences API
+ * and written through a raw NVS handle, so a batch of writes is committed with a single <code>nvs_commit()</code>
  *
- * Provides a static method to load all the values from the NVS
+ * Provides a static method to load all the values from the NVS in a single pass over the namespace.
+ * Changed values are not written immediately but collected and committed to the flash in one batch
+ * after no further change occurred for <code>NVS_COMMIT_DELAY</code> seconds,
+ * when calling <code>commit()</code> or before the system restarts.
+ * Changes of multiple values can be batched using a <code>NVS::Transaction</code>
  */
 struct NVS
 {
+private:
+    using Deferred = std::vector<std::pair<const void*, std::function<void()>>>;
+
+    /*!
+     * @brief Changes and deferred actions of a transaction, which are taken over by the task finishing it
+     */
+    struct Batch
+    {
+        std::vector<NVS*> changed;
+        Deferred deferred;
+        bool commit;
+    };
+
+public:
+    /*!
+     * @brief Flash write statistics
+     */
+    struct Stats
+    {
+        //! The number of value changes
+        uint32_t changes = 0;
+        //! The number of commits performed
+        uint32_t commits = 0;
+        //! The number of values written to the flash
+        uint32_t writes = 0;
+        //! The total time spent writing values to the flash in µs
+        uint64_t write_time_us = 0;
+    };
+
+    /*!
+     * @brief Scope batching changes of any number of values;
+     * when the outermost transaction ends, the observers of each changed value are notified once with its final value,
+     * followed by committing all changes with a single <code>nvs_commit()</code> and running the deferred actions.
+     * Observers and deferred actions run after the transaction released its lock, so they may block (e.g., on I2C)
+     * without blocking other tasks; values changed by the observers are batched into the finishing transaction
+     * @note A transaction is bound to the task creating it; other tasks starting a transaction block until it ends.
+     * Values changed by other tasks without a transaction don't block, but their observers are notified
+     * by the task ending the transaction. The NVS writes each value separately, so a power loss while committing may persist only some of the changes
+     */
+    class Transaction
+    {
+    public:
+        Transaction() : Transaction(true) {}
+
+        ~Transaction()
+        {
+            if (--s_tx_depth > 0)
+            {
+                s_tx_mutex.unlock();
+                return;
+            }
+
+            Batch batch{std::exchange(s_tx_changed, {}), std::exchange(s_tx_deferred, {}), s_tx_commit};
+            {
+                // values changed by other tasks meanwhile are notified along with the transaction's changes
+                std::lock_guard lock(s_pending_mutex);
+                s_tx_owner = nullptr;
+                batch.changed.insert(batch.changed.end(), s_pending.begin(), s_pending.end());
+                s_pending.clear();
+            }
+            s_tx_mutex.unlock();
+            finish(batch);
+        }
+
+        // delete copy constructor and assignment operator
+
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+
+    private:
+        friend struct NVS;
+
+        // implicit transactions only batch notifications but leave committing to the delayed commit
+        explicit Transaction(bool commit)
+        {
+            s_tx_mutex.lock();
+            if (s_tx_depth++ == 0)
+            {
+                s_tx_owner = xTaskGetCurrentTaskHandle();
+                s_tx_commit = false;
+            }
+            s_tx_commit |= commit;
+        }
+
+        static void finish(Batch& batch)
+        {
+            // an observer might start a transaction of its own, which finishes nested in this one
+            auto* outer = std::exchange(t_finishing, &batch);
+
+            // observers might change further values, so notify until nothing changes anymore
+            while (!batch.changed.empty())
+            {
+                for (auto* instance : std::exchange(batch.changed, {}))
+                {
+                    instance->m_changed = false;
+                    instance->notify();
+                }
+            }
+            t_finishing = outer;
+
+            if (batch.commit)
+                commit();
+
+            for (const auto& [key, action] : batch.deferred)
+                action();
+        }
+    };
+
+    /*!
+     * @brief Runs an action once the current transaction ends or immediately if no transaction is active;
+     * actions deferred multiple times with the same key during a transaction are only run once
+     * @param key The key identifying the action, e.g., the address of its owner
+     * @param action The action to run
+     */
+    static void defer(const void* key, const std::function<void()>& action)
+    {
+        auto* deferred = s_tx_owner == xTaskGetCurrentTaskHandle() ? &s_tx_deferred :
+                         t_finishing ? &t_finishing->deferred : nullptr;
+        if (!deferred)
+        {
+            action();
+            return;
+        }
+
+        auto it = std::ranges::find(*deferred, key, &Deferred::value_type::first);
+        if (it != deferred->end())
+            it->second = action;
+        else
+            deferred->emplace_back(key, action);
+    }
+
     /*!
      * @brief Stores a pointer to the instance for static access
+     * @param key The key of the value in the NVS; must be 15 characters or fewer
      */
-    NVS() { s_instances.insert(this); }
+    explicit NVS(const char* key) : m_key(key)
+    {
+        assert(strlen(key) <= 15 && "The key must be 15 characters or less");
+        s_instances.insert(this);
+    }
 
     /*!
      * @brief Destructor. Removes the pointer to the instance
@@ -29,94 +190,636 @@ struct NVS
      */
     static void begin(const char* name)
     {
+        auto start = esp_timer_get_time();
         s_prefs.begin(name, false);
-        for (auto& instance : s_instances)
+        if (auto err = nvs_open(name, NVS_READWRITE, &s_handle); err != ESP_OK)
+            LOG_E("Failed to open NVS namespace %s: %s", name, esp_err_to_name(err));
+
+        // sorted name table for matching the namespace entries to the registered values
+        std::vector<NVS*> table{};
+        table.reserve(s_instances.size());
+        for (auto* instance : s_instances)
         {
             assert(instance && "Found invalid NVS instance");
             if (instance)
-                instance->load();
+                table.push_back(instance);
+        }
+        std::ranges::sort(table, [](auto* a, auto* b) { return strcmp(a->m_key, b->m_key) < 0; });
+        std::vector<bool> loaded(table.size());
+        // the namespace must not be modified while iterating it, so mismatching entries are removed afterward
+        std::vector<std::array<char, NVS_KEY_NAME_MAX_SIZE>> mismatched{};
+
+        // iterate the namespace once instead of looking up each value separately
+        nvs_iterator_t it = nullptr;
+        for (auto err = nvs_entry_find(NVS_DEFAULT_PART_NAME, name, NVS_TYPE_ANY, &it);
+             err == ESP_OK;
+             err = nvs_entry_next(&it))
+        {
+            nvs_entry_info_t info;
+            nvs_entry_info(it, &info);
+
+            auto pos = std::ranges::lower_bound(table, info.key, [](auto* a, auto* b) { return strcmp(a, b) < 0; },
+                                                [](auto* instance) { return instance->m_key; });
+            if (pos == table.end() || strcmp((*pos)->m_key, info.key) != 0)
+                continue;
+
+            if (info.type == (*pos)->type())
+            {
+                loaded[pos - table.begin()] = (*pos)->load();
+            }
+            else
+            {
+                LOG_W("Value for %s has an unexpected type, replacing it with the default value", info.key);
+                std::ranges::copy(info.key, mismatched.emplace_back().begin());
+            }
+        }
+        nvs_release_iterator(it);
+
+        for (const auto& key : mismatched)
+            nvs_erase_key(s_handle, key.data());
+
+        // missing values are migrated from former entries or get their default value; as neither is committed
+        // separately, all of them are committed together
+        size_t defaults = 0;
+        size_t migrated = 0;
+        for (size_t i = 0; i < table.size(); ++i)
+        {
+            if (loaded[i])
+                continue;
+            if (table[i]->migrate())
+            {
+                ++migrated;
+            }
+            else
+            {
+                table[i]->storeDefault();
+                ++defaults;
+            }
         }
+        if (defaults > 0 || migrated > 0 || !mismatched.empty())
+            nvs_commit(s_handle);
+
+        LOG_I("Loaded %zu values (%zu defaults written) in %" PRId64 " us",
+              table.size() - defaults, defaults, esp_timer_get_time() - start);
+
+        // commit changes in a worker task as flash writes would block the timer service
+        s_commit_timer.setDeferred(true);
+        s_commit_timer.once(NVS_COMMIT_DELAY, commit);
+        esp_register_shutdown_handler(commit);
+    }
+
+    /*!
+     * @brief Reads an entry written by a former firmware and erases it; only valid while migrating a value
+     * @param key The key of the entry, which must have been stored as <code>uint8_t</code> or <code>bool</code>
+     * @return The value of the entry or <code>std::nullopt</code> if it doesn't exist
+     */
+    static std::optional<uint8_t> takeLegacy(const char* key)
+    {
+        if (!s_prefs.isKey(key))
+            return std::nullopt;
+        auto value = s_prefs.getUChar(key);
+        if (auto err = nvs_erase_key(s_handle, key); err != ESP_OK)
+            LOG_E("Failed to erase former entry %s: %s", key, esp_err_to_name(err));
+        return value;
+    }
+
+    /*!
+     * @brief Writes all changed values to the NVS
+     */
+    static void commit()
+    {
+        // wait for an active transaction, so a commit doesn't write only part of its changes
+        std::lock_guard tx_lock(s_tx_mutex);
+        std::lock_guard lock(s_mutex);
+        if (s_dirty.empty())
+            return;
+
+        auto start = esp_timer_get_time();
+        uint32_t writes = 0;
+        for (auto* instance : s_dirty)
+        {
+            instance->m_dirty = false;
+            if (instance->store())
+                ++writes;
+        }
+        if (writes > 0)
+            nvs_commit(s_handle);
+        auto duration = esp_timer_get_time() - start;
+
+        ++s_stats.commits;
+        s_stats.writes += writes;
+        s_stats.write_time_us += duration;
+        LOG_D("Committed %" PRIu32 " of %zu changed values in %" PRId64 " us", writes, s_dirty.size(), duration);
+        s_dirty.clear();
+    }
+
+    /*!
+     * @brief Get the flash write statistics
+     */
+    static Stats stats()
+    {
+        std::lock_guard lock(s_mutex);
+        return s_stats;
+    }
+
+    /*!
+     * @brief Serializes all registered values into a binary snapshot;
+     * the snapshot consists of a header (magic, value count) followed by the key, entry type and value of each value
+     * @return The snapshot
+     */
+    static std::vector<uint8_t> exportSnapshot()
+    {
+        std::vector<uint8_t> out(c_snapshot_magic.begin(), c_snapshot_magic.end());
+        append(out, static_cast<uint16_t>(s_instances.size()));
+        for (auto* instance : s_instances)
+        {
+            auto key_len = static_cast<uint8_t>(strlen(instance->m_key));
+            out.push_back(key_len);
+            out.insert(out.end(), instance->m_key, instance->m_key + key_len);
+            out.push_back(static_cast<uint8_t>(instance->type()));
+
+            // the value size is only known after encoding
+            auto size_pos = out.size();
+            append(out, uint16_t{0});
+            instance->encode(out);
+            auto size = static_cast<uint16_t>(out.size() - size_pos - sizeof(uint16_t));
+            memcpy(out.data() + size_pos, &size, sizeof(size));
+        }
+        return out;
+    }
+
+    /*!
+     * @brief Applies a snapshot created by <code>exportSnapshot()</code> inside a single transaction,
+     * so observers are notified once per changed value and the changes are written by a single commit;
+     * values unknown to this firmware are skipped
+     * @note The snapshot is validated completely before any value is changed, but the NVS writes each entry
+     * separately, so a power loss during the import may persist only some of the changes
+     * @param data The snapshot data
+     * @param len The size of the snapshot
+     * @return true if the snapshot was valid and applied, false if it was rejected without changing any value
+     */
+    static bool importSnapshot(const uint8_t* data, size_t len)
+    {
+        struct Entry
+        {
+            NVS* instance;
+            const uint8_t* value;
+            uint16_t size;
+        };
+
+        size_t pos = 0;
+        auto read = [&](void* dst, size_t n)
+        {
+            if (pos + n > len)
+                return false;
+            memcpy(dst, data + pos, n);
+            pos += n;
+            return true;
+        };
+
+        // validate the whole snapshot before applying anything
+        std::array<uint8_t, c_snapshot_magic.size()> magic{};
+        uint16_t count = 0;
+        if (!read(magic.data(), magic.size()) || magic != c_snapshot_magic || !read(&count, sizeof(count)))
+        {
+            LOG_W("Rejected NVS snapshot: invalid header");
+            return false;
+        }
+
+        std::vector<Entry> entries{};
+        entries.reserve(count);
+        for (uint16_t i = 0; i < count; ++i)
+        {
+            char key[16]{};
+            uint8_t key_len = 0, type = 0;
+            uint16_t size = 0;
+            if (!read(&key_len, sizeof(key_len)) || key_len >= sizeof(key) || !read(key, key_len) ||
+                !read(&type, sizeof(type)) || !read(&size, sizeof(size)) || pos + size > len)
+            {
+                LOG_W("Rejected NVS snapshot: truncated entry #%u", i);
+                return false;
+            }
+            const auto* value = data + pos;
+            pos += size;
+
+            auto it = std::ranges::find_if(s_instances, [&](auto* instance) { return strcmp(instance->m_key, key) == 0; });
+            if (it == s_instances.end())
+            {
+                LOG_W("Skipping unknown value %s of NVS snapshot", key);
+                continue;
+            }
+            if (type != (*it)->type() || !(*it)->decodable(value, size))
+            {
+                LOG_W("Rejected NVS snapshot: value for %s has an incompatible type", key);
+                return false;
+            }
+            entries.push_back({*it, value, size});
+        }
+        if (pos != len)
+        {
+            LOG_W("Rejected NVS snapshot: %zu trailing bytes", len - pos);
+            return false;
+        }
+
+        Transaction transaction;
+        for (const auto& [instance, value, size] : entries)
+            instance->decode(value, size);
+        LOG_I("Imported %zu values from NVS snapshot", entries.size());
+        return true;
     }
 
 protected:
     inline static Preferences s_prefs{};
-    virtual void load() = 0;
+    inline static nvs_handle_t s_handle{};
+    //! The key of the value in the NVS
+    const char* const m_key;
+
+    //! Loads the value from the NVS; only called if the key is present; returns false if the stored value is incompatible
+    virtual bool load() = 0;
+    //! Writes the default value to a new entry without committing it
+    virtual void storeDefault() = 0;
+    //! Converts former entries into a new entry without committing it; returns false if there are none
+    virtual bool migrate() = 0;
+    //! The NVS entry type the value is stored as
+    [[nodiscard]] virtual nvs_type_t type() const = 0;
+    //! Writes the value to the NVS if it differs from the stored one; returns true if the value was written
+    virtual bool store() = 0;
+    //! Notifies the observers of the value
+    virtual void notify() = 0;
+    //! Appends the binary representation of the value to a snapshot
+    virtual void encode(std::vector<uint8_t>& out) const = 0;
+    //! Checks if the binary representation of a snapshot value can be decoded
+    [[nodiscard]] virtual bool decodable(const uint8_t* data, size_t len) const = 0;
+    //! Sets the value from its binary representation; only called if the data is decodable
+    virtual void decode(const uint8_t* data, size_t len) = 0;
+
+    //! Appends the raw bytes of a trivially copyable value
+    static void append(std::vector<uint8_t>& out, const auto& value)
+    {
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(value));
+    }
+
+    /*!
+     * @brief Marks the value to be written with the next commit, delaying the commit
+     */
+    void markDirty()
+    {
+        {
+            std::lock_guard lock(s_mutex);
+            ++s_stats.changes;
+            if (!m_dirty)
+            {
+                m_dirty = true;
+                s_dirty.push_back(this);
+            }
+        }
+        s_commit_timer.reset();
+    }
+
+    /*!
+     * @brief Marks the value as changed, notifying its observers once the current transaction ends
+     * or immediately if no transaction is active
+     */
+    void markChanged()
+    {
+        auto self = xTaskGetCurrentTaskHandle();
+        // the finishing transaction of this task batches the changes of its observers without holding the lock
+        if (t_finishing && s_tx_owner != self)
+        {
+            if (!m_changed.exchange(true))
+                t_finishing->changed.push_back(this);
+            return;
+        }
+
+        {
+            // instead of waiting for another task's transaction, its owner notifies the observers when it ends
+            std::lock_guard lock(s_pending_mutex);
+            if (auto owner = s_tx_owner.load(); owner && owner != self)
+            {
+                if (!m_changed.exchange(true))
+                    s_pending.push_back(this);
+                return;
+            }
+        }
+
+        Transaction transaction{false};
+        if (!m_changed.exchange(true))
+            s_tx_changed.push_back(this);
+    }
 
 private:
+    static constexpr std::array<uint8_t, 4> c_snapshot_magic{'N', 'V', 'S', 1};
+
+    bool m_dirty = false;
+    // whether the value is part of a batch to be notified
+    std::atomic<bool> m_changed = false;
+
+    inline static std::recursive_mutex s_tx_mutex{};
+    inline static std::atomic<TaskHandle_t> s_tx_owner{nullptr};
+    inline static int s_tx_depth = 0;
+    inline static bool s_tx_commit = false;
+    inline static std::vector<NVS*> s_tx_changed{};
+    inline static Deferred s_tx_deferred{};
+    // values changed by other tasks during a transaction, guarded by the pending mutex instead of the transaction lock
+    inline static std::mutex s_pending_mutex{};
+    inline static std::vector<NVS*> s_pending{};
+    // the batch of the transaction the current task is finishing, if any
+    inline static thread_local Batch* t_finishing = nullptr;
+
     inline static std::unordered_set<NVS*> s_instances{};
+    inline static std::vector<NVS*> s_dirty{};
+    inline static std::mutex s_mutex{};
+    inline static Stats s_stats{0, 0, 0, 0};
+    inline static Timer s_commit_timer{"nvs commit"};
 };
 
 
-//! Template variable that is true if the type is supported by the Preferences API
-template <typename T> requires std::is_same_v<T, int8_t> || std::is_same_v<T, uint8_t> ||
+//! Template variable that is true if the type is directly supported by the Preferences API
+template <typename T>
+constexpr bool is_nvs_scalar_v = std::is_same_v<T, int8_t> || std::is_same_v<T, uint8_t> ||
     std::is_same_v<T, int16_t> || std::is_same_v<T, uint16_t> ||
     std::is_same_v<T, int32_t> || std::is_same_v<T, uint32_t> ||
     std::is_same_v<T, int64_t> || std::is_same_v<T, uint64_t> ||
     std::is_same_v<T, float> ||
     std::is_same_v<T, double> ||
     std::is_same_v<T, bool> ||
-    std::is_same_v<T, String>
-constexpr bool is_nvs_type_v = true;
+    std::is_same_v<T, String>;
+
+//! Template variable that is true if the type is a trivially copyable aggregate to be stored as a single blob
+template <typename T>
+constexpr bool is_nvs_blob_v = std::is_trivially_copyable_v<T> && std::is_aggregate_v<T> &&
+    !std::is_array_v<T> && std::equality_comparable<T>;
+
+//! Template variable that is true if the type can be stored as a NVV
+template <typename T>
+constexpr bool is_nvs_type_v = is_nvs_scalar_v<T> || is_nvs_blob_v<T>;
+
+/*!
+ * @brief Tag stored in front of a blob value to detect incompatible layouts;
+ * combines the size of the type with its optional <code>static constexpr uint16_t nvs_version</code> member,
+ * which should be incremented whenever the meaning of the members changes
+ */
+template <typename T>
+constexpr uint32_t nvs_blob_tag_v = [] {
+    uint32_t version = 0;
+    if constexpr (requires { T::nvs_version; }) version = T::nvs_version;
+    return version << 16 | static_cast<uint32_t>(sizeof(T));
+}();
 
 
 /*!
  * @brief Class for storing a non-volatile value (NVV) in the non-volatile storage (NVS) using the Preferences API with
  * the possibility to attach observers to be called when the value is changed
- * @tparam T The type of the value to be stored
+ * @tparam T The type of the value to be stored; either a type supported by the Preferences API or
+ * a trivially copyable aggregate, which is stored as a single versioned blob and whose members can be accessed as fields
  * @note Changing the value of the NVV using the assignment operator automatically syncs the value with the NVS.
- * When changing the value using operations on a reference of a NVV,
- * it is necessary to manually call <code>sync()</code>.
- * Observers will only be called on sync, but not on load.
+ * Writes are serialized and publish a snapshot of the value, which all reads return, so a read never waits
+ * for a writer and never returns a partially written value.
+ * Observers are called immediately on sync, but not on load; the value is written to the flash with the next commit.
  */
 template <typename T> requires is_nvs_type_v<T>
 struct NVV final : private NVS
 {
     using Observer = std::function<void(const T&)>;
 
+    /*!
+     * @brief Accessor to a single member of a struct-valued NVV, behaving like a NVV of the member type
+     * @tparam M The type of the member
+     */
+    template <typename M> requires is_nvs_blob_v<T>
+    class Field
+    {
+    public:
+        /*!
+         * @brief Constructor
+         * @param nvv The NVV containing the member
+         * @param member Pointer to the member
+         */
+        Field(NVV& nvv, M T::* member) : m_nvv(nvv), m_member(member) {}
+
+        /*!
+         * @brief Sets the member and syncs the containing value
+         * @param val The value to be stored
+         * @return A reference to this object
+         */
+        Field& operator=(const M& val)
+        {
+            m_nvv.write([&](T& value) { value.*m_member = val; });
+            return *this;
+        }
+
+        /*!
+         * @brief Reads the member from the last published snapshot
+         */
+        M operator*() const { return read(); }
+
+        /*!
+         * @brief Explicit conversion to the member type, reading the last published snapshot
+         * @return The member value
+         */
+        explicit operator M() const { return read(); }
+
+        /*!
+         * @brief Reads the member from the last published snapshot; safe to be called from any task
+         * @return The member value
+         */
+        [[nodiscard]] M read() const { return m_nvv.read().*m_member; }
+
+        /**
+         * @brief Attach an observer to be called when the member changes
+         * @param observer The observer to attach; must have the signature <code>void(const M&)</code>
+         */
+        void observe(const auto& observer)
+        {
+            m_nvv.observe([&nvv = m_nvv, member = m_member, observer](const T& value)
+            {
+                if (value.*member != nvv.m_notified.*member)
+                    observer(value.*member);
+            });
+        }
+
+        // delete copy constructor and assignment operator
+
+        Field(const Field&) = delete;
+        Field& operator=(const Field&) = delete;
+
+    private:
+        NVV& m_nvv;
+        M T::* m_member;
+    };
+
     /*!
      * @brief Constructor
      * @param name The name of the value to be stored in the NVS; must be 15 characters or fewer
      * @param value The default value to be stored in the NVS
      */
-    explicit NVV(const char* name, T value = {}) : m_value(value), m_name(name)
+    explicit NVV(const char* name, T value = {}) :
+        NVS(name), m_value(value), m_synced(value), m_stored(value), m_notified(value), m_published(value) {}
+
+    /*!
+     * @brief Loads the value from the NVS
+     * @return false if the stored value has an incompatible layout, so it must be replaced by the default value
+     */
+    bool load() override
+    {
+        if constexpr (is_nvs_blob_v<T>)
+        {
+            Blob blob{};
+            if (s_prefs.getBytes(m_key, &blob, sizeof(blob)) != sizeof(blob) || blob.tag != nvs_blob_tag_v<T>)
+            {
+                LOG_W("Value for %s has an incompatible layout, replacing it with the default value", m_key);
+                return false;
+            }
+            m_value = blob.value;
+        }
+        else
+        {
+            m_value = get();
+        }
+        LOG_D("Loaded value for %s: %s", m_key, str(m_value).c_str());
+        m_synced = m_stored = m_notified = m_value;
+        m_published.store(m_value);
+        return true;
+    }
+
+    /*!
+     * @brief Writes the default value to a new entry; committed by the caller
+     */
+    void storeDefault() override
+    {
+        LOG_N("No value for %s found, creating a new entry with the default value", m_key);
+        put(m_value);
+        m_synced = m_stored = m_notified = m_value;
+        m_published.store(m_value);
+    }
+
+    /*!
+     * @brief Writes the value converted from former entries to a new entry; committed by the caller
+     * @return false if no migration was set or no former entries exist
+     */
+    bool migrate() override
+    {
+        if (!m_migration || !m_migration(m_value))
+            return false;
+        LOG_N("Migrated value for %s from its former entries", m_key);
+        put(m_value);
+        m_synced = m_stored = m_notified = m_value;
+        m_published.store(m_value);
+        return true;
+    }
+
+    /*!
+     * @brief Get the NVS entry type the Preferences API stores the value as
+     */
+    [[nodiscard]] nvs_type_t type() const override
+    {
+        if constexpr (std::is_same_v<T, int8_t>) return NVS_TYPE_I8;
+        if constexpr (std::is_same_v<T, uint8_t> || std::is_same_v<T, bool>) return NVS_TYPE_U8;
+        if constexpr (std::is_same_v<T, int16_t>) return NVS_TYPE_I16;
+        if constexpr (std::is_same_v<T, uint16_t>) return NVS_TYPE_U16;
+        if constexpr (std::is_same_v<T, int32_t>) return NVS_TYPE_I32;
+        if constexpr (std::is_same_v<T, uint32_t>) return NVS_TYPE_U32;
+        if constexpr (std::is_same_v<T, int64_t>) return NVS_TYPE_I64;
+        if constexpr (std::is_same_v<T, uint64_t>) return NVS_TYPE_U64;
+        if constexpr (std::is_same_v<T, String>) return NVS_TYPE_STR;
+        // floating point values and aggregates are stored as blobs
+        return NVS_TYPE_BLOB;
+    }
+
+    /*!
+     * @brief Writes the value to the NVS if it differs from the last written value
+     * @return true if the value was written
+     */
+    bool store() override
     {
-        assert(strlen(name) <= 15 && "The name must be 15 characters or less");
+        // the commit runs on the timer worker, thus only the published value may be accessed
+        const T value = m_published.load();
+        if (value == m_stored)
+            return false;
+        LOG_D("Putting value for %s: %s", m_key, str(value).c_str());
+        put(value);
+        m_stored = value;
+        return true;
+    }
+
+    /*!
+     * @brief Appends the published value to a snapshot; blobs include their layout tag
+     */
+    void encode(std::vector<uint8_t>& out) const override
+    {
+        const T value = read();
+        if constexpr (std::is_same_v<T, String>)
+            out.insert(out.end(), value.c_str(), value.c_str() + value.length());
+        else if constexpr (is_nvs_blob_v<T>)
+            append(out, blob(value));
+        else
+            append(out, value);
     }
 
     /*!
-     * @brief Loads the value from the NVS or, if the value is not present, creates a new entry
+     * @brief Checks the size and, for blobs, the layout tag of a snapshot value
      */
-    void load() override
+    [[nodiscard]] bool decodable(const uint8_t* data, size_t len) const override
     {
-        if (s_prefs.isKey(m_name))
+        if constexpr (std::is_same_v<T, String>)
         {
-            m_value = get();
-            LOG_D("Loaded value for %s: %s", m_name, String(m_value).c_str());
+            return true;
+        }
+        else if constexpr (is_nvs_blob_v<T>)
+        {
+            uint32_t tag;
+            if (len != sizeof(Blob))
+                return false;
+            memcpy(&tag, data + offsetof(Blob, tag), sizeof(tag));
+            return tag == nvs_blob_tag_v<T>;
         }
         else
         {
-            LOG_N("No value for %s found, creating a new entry with the default value", m_name);
-            put();
+            return len == sizeof(T);
         }
     }
 
     /*!
-     * @brief Stores the value in the NVS only if it has changed
+     * @brief Sets the value from a snapshot value
      */
-    void sync()
+    void decode(const uint8_t* data, size_t len) override
     {
-        if (m_value == get())
+        if constexpr (std::is_same_v<T, String>)
         {
-            LOG_D("Value for %s is the same, no storing done", m_name);
-            return;
+            *this = String(reinterpret_cast<const char*>(data), len);
+        }
+        else if constexpr (std::is_same_v<T, bool>)
+        {
+            *this = data[0] != 0;
+        }
+        else if constexpr (is_nvs_blob_v<T>)
+        {
+            Blob blob;
+            memcpy(&blob, data, sizeof(blob));
+            *this = blob.value;
+        }
+        else
+        {
+            T value;
+            memcpy(&value, data, sizeof(value));
+            *this = value;
         }
-        LOG_D("Putting value for %s: %s", m_name, String(m_value).c_str());
-        put();
+    }
 
+    /*!
+     * @brief Notifies the observers with the current value
+     */
+    void notify() override
+    {
+        // transactions finish without holding their lock, so several tasks might notify the same value
+        std::lock_guard lock(m_notify_mutex);
+        const T value = m_published.load();
         for (const auto& observer : m_observers)
         {
-            observer(m_value);
+            observer(value);
         }
+        m_notified = value;
     }
 
     /*!
@@ -126,31 +829,26 @@ struct NVV final : private NVS
      */
     NVV& operator=(const T& val)
     {
-        m_value = val;
-        sync();
+        write([&](T& value) { value = val; });
         return *this;
     }
 
     /*!
-     * @brief Gets a reference to the stored value
-     */
-    T& operator*() { return m_value; }
-
-    /*!
-     * @brief Gets a const reference to the stored value
+     * @brief Reads the last published value without waiting for a writer; safe to be called from any task
+     * @return A copy of the value
      */
-    const T& operator*() const { return m_value; }
+    [[nodiscard]] T read() const { return m_published.load(); }
 
     /*!
-     * @brief Gets a pointer to the stored value
+     * @brief Reads the last published value like read()
      */
-    T* operator->() { return &m_value; }
+    T operator*() const { return read(); }
 
     /*!
-     * @brief Explicit conversion to the stored value type
+     * @brief Explicit conversion to the stored value type, reading the last published value
      * @return The stored value
      */
-    explicit operator T() const { return m_value; }
+    explicit operator T() const { return read(); }
 
     /**
      * @brief Attach an observer to this value to be called when the value changes
@@ -161,6 +859,16 @@ struct NVV final : private NVS
         m_observers.emplace_back(observer);
     }
 
+    /**
+     * @brief Sets a function converting entries of a former firmware into the value, which is called when loading
+     * finds no entry for the value; the function should read and erase the former entries using takeLegacy()
+     * @param migration Function setting the value passed by reference, returning false if no former entries exist
+     */
+    void migrateFrom(const std::function<bool(T&)>& migration)
+    {
+        m_migration = migration;
+    }
+
     /**
      * @brief Remove an observer from the observer list of this value
      * @param observer The observer to remove from this NVV
@@ -177,40 +885,108 @@ struct NVV final : private NVS
 
 private:
     T m_value{};
-    const char* m_name;
+    // the value at the last sync
+    T m_synced{};
+    // the value last written to the NVS
+    T m_stored{};
+    // the value observers were last notified of
+    T m_notified{};
+    // the value as seen by readers of other tasks
+    snapshot_t<T> m_published;
+    // serializes writers
+    std::mutex m_write_mutex{};
+    // serializes notifications, which may change the value again
+    std::recursive_mutex m_notify_mutex{};
     std::vector<Observer> m_observers{};
+    std::function<bool(T&)> m_migration{};
+
+    // layout of aggregates stored as blobs
+    struct Blob
+    {
+        uint32_t tag;
+        T value;
+    };
+
+    // the padding of the blob is written as well, so it is zeroed instead of being left uninitialized
+    static Blob blob(const T& value)
+    {
+        Blob data;
+        memset(&data, 0, sizeof(data));
+        data.tag = nvs_blob_tag_v<T>;
+        data.value = value;
+        return data;
+    }
+
+    [[nodiscard]] static String str(const T& value)
+    {
+        if constexpr (is_nvs_blob_v<T>)
+            return "<" + String(sizeof(T)) + " bytes>";
+        else
+            return String(value);
+    }
+
+    /*!
+     * @brief Modifies the value while holding the writer lock and publishes it if it changed
+     * @param modify Function modifying the value passed by reference
+     */
+    void write(const auto& modify)
+    {
+        {
+            std::lock_guard lock(m_write_mutex);
+            modify(m_value);
+            if (m_value == m_synced)
+            {
+                LOG_D("Value for %s is the same, no storing done", m_key);
+                return;
+            }
+            m_synced = m_value;
+            m_published.store(m_value);
+        }
+        // observers may write again, thus they must not run while holding the lock
+        markDirty();
+        markChanged();
+    }
 
     T get()
     {
-        if constexpr (std::is_same_v<T, int8_t>) return s_prefs.getChar(m_name);
-        if constexpr (std::is_same_v<T, uint8_t>) return s_prefs.getUChar(m_name);
-        if constexpr (std::is_same_v<T, int16_t>) return s_prefs.getShort(m_name);
-        if constexpr (std::is_same_v<T, uint16_t>) return s_prefs.getUShort(m_name);
-        if constexpr (std::is_same_v<T, int32_t>) return s_prefs.getInt(m_name);
-        if constexpr (std::is_same_v<T, uint32_t>) return s_prefs.getUInt(m_name);
-        if constexpr (std::is_same_v<T, int64_t>) return s_prefs.getLong(m_name);
-        if constexpr (std::is_same_v<T, uint64_t>) return s_prefs.getULong(m_name);
-        if constexpr (std::is_same_v<T, float>) return s_prefs.getFloat(m_name);
-        if constexpr (std::is_same_v<T, double>) return s_prefs.getDouble(m_name);
-        if constexpr (std::is_same_v<T, bool>) return s_prefs.getBool(m_name);
-        if constexpr (std::is_same_v<T, String>) return s_prefs.getString(m_name);
+        if constexpr (std::is_same_v<T, int8_t>) return s_prefs.getChar(m_key);
+        if constexpr (std::is_same_v<T, uint8_t>) return s_prefs.getUChar(m_key);
+        if constexpr (std::is_same_v<T, int16_t>) return s_prefs.getShort(m_key);
+        if constexpr (std::is_same_v<T, uint16_t>) return s_prefs.getUShort(m_key);
+        if constexpr (std::is_same_v<T, int32_t>) return s_prefs.getInt(m_key);
+        if constexpr (std::is_same_v<T, uint32_t>) return s_prefs.getUInt(m_key);
+        if constexpr (std::is_same_v<T, int64_t>) return s_prefs.getLong64(m_key);
+        if constexpr (std::is_same_v<T, uint64_t>) return s_prefs.getULong64(m_key);
+        if constexpr (std::is_same_v<T, float>) return s_prefs.getFloat(m_key);
+        if constexpr (std::is_same_v<T, double>) return s_prefs.getDouble(m_key);
+        if constexpr (std::is_same_v<T, bool>) return s_prefs.getBool(m_key);
+        if constexpr (std::is_same_v<T, String>) return s_prefs.getString(m_key);
         return T{};
     }
 
-    void put()
-    {
-        if /**/ constexpr (std::is_same_v<T, int8_t>) s_prefs.putChar(m_name, m_value);
-        else if constexpr (std::is_same_v<T, uint8_t>) s_prefs.putUChar(m_name, m_value);
-        else if constexpr (std::is_same_v<T, int16_t>) s_prefs.putShort(m_name, m_value);
-        else if constexpr (std::is_same_v<T, uint16_t>) s_prefs.putUShort(m_name, m_value);
-        else if constexpr (std::is_same_v<T, int32_t>) s_prefs.putInt(m_name, m_value);
-        else if constexpr (std::is_same_v<T, uint32_t>) s_prefs.putUInt(m_name, m_value);
-        else if constexpr (std::is_same_v<T, int64_t>) s_prefs.putLong(m_name, m_value);
-        else if constexpr (std::is_same_v<T, uint64_t>) s_prefs.putULong(m_name, m_value);
-        else if constexpr (std::is_same_v<T, float>) s_prefs.putFloat(m_name, m_value);
-        else if constexpr (std::is_same_v<T, double>) s_prefs.putDouble(m_name, m_value);
-        else if constexpr (std::is_same_v<T, bool>) s_prefs.putBool(m_name, m_value);
-        else if constexpr (std::is_same_v<T, String>) s_prefs.putString(m_name, m_value);
+    // writes the value without committing it, using the same entry types as the Preferences API
+    void put(const T& value)
+    {
+        esp_err_t err = ESP_OK;
+        if /**/ constexpr (std::is_same_v<T, int8_t>) err = nvs_set_i8(s_handle, m_key, value);
+        else if constexpr (std::is_same_v<T, uint8_t>) err = nvs_set_u8(s_handle, m_key, value);
+        else if constexpr (std::is_same_v<T, int16_t>) err = nvs_set_i16(s_handle, m_key, value);
+        else if constexpr (std::is_same_v<T, uint16_t>) err = nvs_set_u16(s_handle, m_key, value);
+        else if constexpr (std::is_same_v<T, int32_t>) err = nvs_set_i32(s_handle, m_key, value);
+        else if constexpr (std::is_same_v<T, uint32_t>) err = nvs_set_u32(s_handle, m_key, value);
+        else if constexpr (std::is_same_v<T, int64_t>) err = nvs_set_i64(s_handle, m_key, value);
+        else if constexpr (std::is_same_v<T, uint64_t>) err = nvs_set_u64(s_handle, m_key, value);
+        else if constexpr (std::is_same_v<T, float>) err = nvs_set_blob(s_handle, m_key, &value, sizeof(value));
+        else if constexpr (std::is_same_v<T, double>) err = nvs_set_blob(s_handle, m_key, &value, sizeof(value));
+        else if constexpr (std::is_same_v<T, bool>) err = nvs_set_u8(s_handle, m_key, value ? 1 : 0);
+        else if constexpr (std::is_same_v<T, String>) err = nvs_set_str(s_handle, m_key, value.c_str());
+        else if constexpr (is_nvs_blob_v<T>)
+        {
+            auto data = blob(value);
+            err = nvs_set_blob(s_handle, m_key, &data, sizeof(data));
+        }
+        if (err != ESP_OK)
+            LOG_E("Failed to write value for %s: %s", m_key, esp_err_to_name(err));
     }
 };
 
@@ -0,0 +1,174 @@
+#ifndef Q15_GAIN_HPP
+#define Q15_GAIN_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+
+/**
+ * Fixed-point gain stage for interleaved 16 bit samples, combining a level (e.g., the volume)
+ * with an envelope ramping linearly between two gains, e.g., for fading in an alarm over minutes
+ *
+ * Gains are Q15 values, i.e., c_unity (32768) passes samples unchanged; samples are scaled by an integer
+ * multiplication and shift, so no floating point operation is needed per sample.
+ * The envelope advances per frame, so a fade ends exactly after its duration, regardless of the block sizes.
+ * The level, fades and muting may be changed from any task, while apply() must only be called from a single task;
+ * a fade is started by the next call of apply()
+ */
+class Q15Gain
+{
+public:
+    static constexpr uint16_t c_unity = 1 << 15;
+
+    /**
+     * Converts a percentage to a gain, e.g., a volume of 0 to 100
+     */
+    static constexpr uint16_t fromPercent(uint8_t percent) { return std::min<uint32_t>(percent, 100) * c_unity / 100; }
+
+    /**
+     * Sets the format of the samples, which the duration of a fade depends on
+     * @param sample_rate The frames per second
+     * @param channels The samples per frame
+     */
+    void setFormat(uint32_t sample_rate, uint8_t channels)
+    {
+        m_sample_rate = sample_rate;
+        m_channels = std::max<uint8_t>(channels, 1);
+    }
+
+    /**
+     * Sets the level instantly, which is multiplied with the envelope
+     * @param level The gain; values above c_unity are limited
+     */
+    void setLevel(uint16_t level) { m_level = std::min(level, c_unity); }
+
+    /**
+     * Ramps the envelope linearly from one gain to another
+     * @param from The gain to start at
+     * @param to The gain to end at, which is kept after the fade
+     * @param ms The duration of the fade; 0 sets the envelope to the end gain instantly
+     */
+    void fade(uint16_t from, uint16_t to, uint32_t ms)
+    {
+        m_request = static_cast<uint64_t>(std::min(from, c_unity)) << 48 |
+            static_cast<uint64_t>(std::min(to, c_unity)) << 32 | ms;
+    }
+
+    /**
+     * Ends a fade, passing samples at the level only
+     */
+    void cancelFade() { fade(c_unity, c_unity, 0); }
+
+    /**
+     * Silences the samples instantly; a fade keeps advancing while muted, so unmuting continues at its current gain
+     */
+    void setMuted(bool muted) { m_muted = muted; }
+
+    /**
+     * Check whether samples pass unchanged, so applying the gain can be skipped; only valid on the applying task
+     */
+    [[nodiscard]] bool bypassed() const
+    {
+        return m_request == c_no_request && !m_muted && m_remaining == 0 && m_envelope == c_envelope_unity && m_level == c_unity;
+    }
+
+    /**
+     * Scales samples in place
+     * @param samples The interleaved samples
+     * @param count The number of samples, i.e., frames times channels
+     */
+    void apply(int16_t* samples, size_t count)
+    {
+        if (auto request = m_request.exchange(c_no_request); request != c_no_request)
+            start(request);
+
+        auto channels = m_channels.load();
+        auto frames = count / channels;
+        if (m_muted)
+        {
+            memset(samples, 0, count * sizeof(int16_t));
+            advance(frames);
+            return;
+        }
+
+        uint32_t level = m_level;
+        while (frames > 0)
+        {
+            if (m_remaining == 0)
+            {
+                scale(samples, frames * channels, level * (m_envelope >> 16) >> 15);
+                return;
+            }
+
+            // the envelope changes per frame, so each frame's gain is computed, which is still one
+            // multiplication per frame in addition to the one per sample
+            auto ramp = static_cast<size_t>(std::min<uint32_t>(frames, m_remaining));
+            for (size_t frame = 0; frame < ramp; ++frame)
+            {
+                auto gain = static_cast<int32_t>(level * (m_envelope >> 16) >> 15);
+                for (uint8_t channel = 0; channel < channels; ++channel, ++samples)
+                    *samples = static_cast<int16_t>((*samples * gain + 0x4000) >> 15);
+                m_envelope += m_step;
+            }
+            frames -= ramp;
+            if ((m_remaining -= ramp) == 0)
+                m_envelope = m_target << 16;
+        }
+    }
+
+private:
+    static constexpr uint64_t c_no_request = UINT64_MAX;
+    static constexpr uint32_t c_envelope_unity = static_cast<uint32_t>(c_unity) << 16;
+
+    void start(uint64_t request)
+    {
+        auto from = static_cast<uint32_t>(request >> 48 & 0xFFFF);
+        m_target = static_cast<uint32_t>(request >> 32 & 0xFFFF);
+        auto ms = static_cast<uint32_t>(request);
+        m_remaining = static_cast<uint32_t>(static_cast<uint64_t>(ms) * m_sample_rate / 1000);
+        // the envelope has 16 fractional bits, so even a fade over minutes advances by a non-zero step per frame;
+        // the step is truncated towards zero, so the envelope never overshoots and is set to the target at the end
+        m_envelope = (m_remaining > 0 ? from : m_target) << 16;
+        m_step = m_remaining > 0 ?
+            static_cast<uint32_t>((static_cast<int64_t>(m_target) - from) * 65536 / static_cast<int64_t>(m_remaining)) : 0;
+    }
+
+    void advance(size_t frames)
+    {
+        auto ramp = std::min<uint32_t>(frames, m_remaining);
+        // the step is added in unsigned arithmetic, which wraps correctly for negative steps
+        m_envelope += m_step * ramp;
+        if ((m_remaining -= ramp) == 0)
+            m_envelope = m_target << 16;
+    }
+
+    static void scale(int16_t* samples, size_t count, uint32_t gain)
+    {
+        if (gain >= c_unity)
+            return;
+        if (gain == 0)
+        {
+            memset(samples, 0, count * sizeof(int16_t));
+            return;
+        }
+        for (auto* end = samples + count; samples < end; ++samples)
+            *samples = static_cast<int16_t>((*samples * static_cast<int32_t>(gain) + 0x4000) >> 15);
+    }
+
+    std::atomic<uint16_t> m_level{c_unity};
+    std::atomic<bool> m_muted{false};
+    std::atomic<uint64_t> m_request{c_no_request};
+    std::atomic<uint32_t> m_sample_rate{44100};
+    std::atomic<uint8_t> m_channels{2};
+
+    // the envelope in Q15.16, which is only accessed by the applying task
+    uint32_t m_envelope{c_envelope_unity};
+    uint32_t m_step{};
+    uint32_t m_target{c_unity};
+    uint32_t m_remaining{};
+};
+
+
+#endif // Q15_GAIN_HPP
@@ -0,0 +1,133 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <Arduino.h>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+
+/**
+ * Sequence lock holding a copy of a trivially copyable value;
+ * readers never block and retry only if a write happened concurrently,
+ * writers copy the value inside a critical section so that a reader can never spin on a preempted writer
+ *
+ * @tparam T The type of the value; must be trivially copyable
+ */
+template <typename T> requires std::is_trivially_copyable_v<T>
+class SeqLock
+{
+public:
+    explicit SeqLock(const T& value = {}) { std::memcpy(m_data, &value, sizeof(T)); }
+
+    /**
+     * Reads a consistent copy of the value
+     * @return The value of the last completed store
+     */
+    [[nodiscard]] T load() const
+    {
+        T value;
+        uint32_t seq;
+        do
+        {
+            seq = m_seq.load(std::memory_order_acquire);
+            std::memcpy(&value, m_data, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        while (seq & 1 || seq != m_seq.load(std::memory_order_relaxed));
+        return value;
+    }
+
+    /**
+     * Replaces the value
+     * @param value The new value
+     */
+    void store(const T& value)
+    {
+        portENTER_CRITICAL(&m_lock);
+        auto seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(m_data, &value, sizeof(T));
+        m_seq.store(seq + 2, std::memory_order_release);
+        portEXIT_CRITICAL(&m_lock);
+    }
+
+    // delete copy constructor and assignment operator
+
+    SeqLock(const SeqLock&) = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+
+private:
+    // odd while a write is in progress
+    std::atomic<uint32_t> m_seq{0};
+    alignas(T) unsigned char m_data[sizeof(T)];
+    portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+};
+
+
+/**
+ * Read-copy-update cell for values that are not trivially copyable, e.g., String;
+ * a store publishes a new immutable copy and readers keep the copy they loaded alive,
+ * so a value is never modified or freed while it is being read
+ *
+ * Copying the value happens outside of any lock, but exchanging the shared pointer and adjusting its reference count
+ * is not lock-free: the atomic shared pointer functions take a lock from a small pool shared by all cells,
+ * so a reader may briefly wait for a concurrent load or store of any cell, though never for a writer copying a value
+ *
+ * @tparam T The type of the value
+ */
+template <typename T>
+class RcuCell
+{
+public:
+    explicit RcuCell(const T& value = {}) : m_value(std::make_shared<const T>(value)) {}
+
+    /**
+     * Gets the current immutable copy of the value
+     * @return A shared pointer to the value of the last completed store
+     */
+    [[nodiscard]] std::shared_ptr<const T> get() const { return std::atomic_load(&m_value); }
+
+    /**
+     * Reads a copy of the value
+     * @return The value of the last completed store
+     */
+    [[nodiscard]] T load() const { return *get(); }
+
+    /**
+     * Replaces the value; the previous copy is freed once its last reader releases it
+     * @param value The new value
+     */
+    void store(const T& value) { std::atomic_store(&m_value, std::make_shared<const T>(value)); }
+
+    // delete copy constructor and assignment operator
+
+    RcuCell(const RcuCell&) = delete;
+    RcuCell& operator=(const RcuCell&) = delete;
+
+private:
+    std::shared_ptr<const T> m_value;
+};
+
+
+//! Selects the snapshot type to be used for the given value type
+template <typename T>
+struct snapshot
+{
+    using type = RcuCell<T>;
+};
+
+template <typename T> requires std::is_trivially_copyable_v<T>
+struct snapshot<T>
+{
+    using type = SeqLock<T>;
+};
+
+//! Snapshot type to be used for the given value type
+template <typename T>
+using snapshot_t = typename snapshot<T>::type;
+
+
+#endif //SNAPSHOT_HPP
@@ -69,4 +69,33 @@ namespace ArduinoJson
 } // namespace ArduinoJson
 
 
+/**
+ * Serializes a container as a JSON array directly to a Print (e.g., a file or a network stream);
+ * unlike converting the container into a JsonDocument, only a single element is held in a document at a time,
+ * so the memory needed does not depend on the container's size
+ * @tparam Container The container type; its elements are converted using their Converter specializations
+ * @param src The container to serialize
+ * @param out The Print to write the JSON array to
+ * @return The number of bytes written
+ */
+template <typename Container>
+size_t serializeJsonArray(const Container& src, Print& out)
+{
+    JsonDocument element;
+    size_t size = out.write('[');
+    auto first = true;
+    for (const auto& item : src)
+    {
+        if (!first)
+            size += out.write(',');
+        first = false;
+
+        element.set(item);
+        size += serializeJson(element, out);
+    }
+    element.clear();
+    return size + out.write(']');
+}
+
+
 #endif //VECTOR_JSON_HPP
@@ -1,6 +1,9 @@
 #ifndef THREAD_H
 #define THREAD_H
 
+#include <esp_timer.h>
+#include <iterator>
+
 #ifndef THREAD_DEFAULT_STACK_SIZE
 #define THREAD_DEFAULT_STACK_SIZE 2048
 #endif
@@ -17,6 +20,8 @@ struct ThreadCfg
     int priority = tskIDLE_PRIORITY;
     //! The core for the task to be pinned to; defaults to no affinity
     int coreId = tskNO_AFFINITY;
+    //! Whether the task is started by the constructor; otherwise, the implementing class must call startTask()
+    bool autostart = true;
 };
 
 
@@ -25,6 +30,9 @@ struct ThreadCfg
  * the thread runs immediately after calling the constructor and executes the run-method inside the task,
  * which must be implemented by any class implementing a thread
  *
+ * A thread constructed while the scheduler is running may run before the implementing class is constructed;
+ * such classes should disable autostart and call startTask() at the end of their constructor
+ *
  * @tparam STACK The size of the task stack; default: THREAD_DEFAULT_STACK_SIZE
  */
 template <size_t STACK = THREAD_DEFAULT_STACK_SIZE>
@@ -34,17 +42,17 @@ struct Thread
      * Creates a new thread task with the given configuration
      * @param cfg Thread configuration
      */
-    explicit Thread(const ThreadCfg& cfg = {})
+    explicit Thread(const ThreadCfg& cfg = {}) : m_cfg(cfg)
     {
-        // ReSharper disable once CppDFAEndlessLoop
-        m_task =
-            xTaskCreateStaticPinnedToCore([](void* t) { while (true) static_cast<Thread*>(t)->run(); },
-                                          cfg.name, STACK, this, cfg.priority, m_taskStack, &m_taskBuf, cfg.coreId);
+        if (cfg.autostart)
+            startTask();
     }
 
     virtual ~Thread()
     {
-        vTaskDelete(m_task);
+        // a null handle would delete the calling task
+        if (m_task)
+            vTaskDelete(m_task);
     }
 
     /**
@@ -72,7 +80,21 @@ protected:
      */
     virtual void run() = 0;
 
+    /**
+     * Starts the thread task, unless it was already started
+     */
+    void startTask()
+    {
+        if (m_task)
+            return;
+        // ReSharper disable once CppDFAEndlessLoop
+        m_task =
+            xTaskCreateStaticPinnedToCore([](void* t) { while (true) static_cast<Thread*>(t)->run(); },
+                                          m_cfg.name, STACK, this, m_cfg.priority, m_taskStack, &m_taskBuf, m_cfg.coreId);
+    }
+
 private:
+    ThreadCfg m_cfg;
     TaskHandle_t m_task{};
     StaticTask_t m_taskBuf{};
     StackType_t m_taskStack[STACK]{};
@@ -102,4 +124,104 @@ private:
 };
 
 
+/**
+ * Timing statistics of a periodic thread
+ */
+struct PeriodicStats
+{
+    //! Upper bounds (exclusive) of the jitter histogram buckets in µs; the last bucket holds all larger values
+    static constexpr uint32_t c_jitter_bounds_us[] = {100, 250, 500, 1000, 2500, 5000, 10000};
+
+    //! The number of iterations run
+    uint32_t iterations = 0;
+    //! The number of iterations that overran their period
+    uint32_t deadline_misses = 0;
+    //! The largest deviation of an iteration's start from its scheduled start in µs
+    uint32_t max_jitter_us = 0;
+    //! Histogram of the deviation of each iteration's start from its scheduled start
+    uint32_t jitter_histogram[std::size(c_jitter_bounds_us) + 1]{};
+};
+
+
+/**
+ * Implementation of Thread running its tick-method with a fixed period using <code>xTaskDelayUntil</code>,
+ * thus not drifting by the tick's execution time;
+ * records deadline misses and the jitter of each iteration
+ *
+ * @tparam PERIOD_MS The initial period of the thread in milliseconds; may be changed by the tick-method
+ * @tparam STACK The size of the task stack; default: THREAD_DEFAULT_STACK_SIZE
+ */
+template <uint32_t PERIOD_MS, size_t STACK = THREAD_DEFAULT_STACK_SIZE>
+struct PeriodicThread : Thread<STACK>
+{
+    /**
+     * Creates a new periodic thread task with the given configuration
+     * @param cfg Thread configuration
+     */
+    explicit PeriodicThread(const ThreadCfg& cfg = {}) : Thread<STACK>(cfg) {}
+
+    /**
+     * Get the timing statistics of this thread
+     */
+    [[nodiscard]] const PeriodicStats& stats() const { return m_stats; }
+
+protected:
+    /**
+     * The function to be run once every period inside the thread task
+     */
+    virtual void tick() = 0;
+
+    /**
+     * Changes the period, starting with the delay following the current iteration;
+     * must only be called from inside the thread task
+     * @param ms The new period in milliseconds
+     */
+    void setPeriod(uint32_t ms)
+    {
+        m_period_ms = ms;
+    }
+
+private:
+    uint32_t m_period_ms{PERIOD_MS};
+    TickType_t m_last_wake{};
+    int64_t m_scheduled_us{-1};
+    PeriodicStats m_stats{};
+
+    void run() final
+    {
+        auto now = esp_timer_get_time();
+        if (m_scheduled_us < 0)
+        {
+            m_last_wake = xTaskGetTickCount();
+        }
+        else
+        {
+            auto jitter = static_cast<uint32_t>(_abs(now - m_scheduled_us));
+            size_t bucket = 0;
+            while (bucket < std::size(PeriodicStats::c_jitter_bounds_us) &&
+                   jitter >= PeriodicStats::c_jitter_bounds_us[bucket])
+                ++bucket;
+            ++m_stats.jitter_histogram[bucket];
+            m_stats.max_jitter_us = _max(m_stats.max_jitter_us, jitter);
+        }
+
+        tick();
+        ++m_stats.iterations;
+
+        if (xTaskDelayUntil(&m_last_wake, pdMS_TO_TICKS(m_period_ms)) == pdFALSE)
+        {
+            // the tick overran its period (or the thread was suspended);
+            // resynchronize instead of catching up with a burst of iterations
+            ++m_stats.deadline_misses;
+            m_last_wake = xTaskGetTickCount();
+            m_scheduled_us = esp_timer_get_time();
+        }
+        else
+        {
+            m_scheduled_us = (m_scheduled_us < 0 ? now : m_scheduled_us) + m_period_ms * 1000LL;
+        }
+    }
+};
+
+
 #endif //THREAD_H
@@ -1,25 +1,128 @@
 #include "timer.h"
 
+#include "log.h"
+#include "thread.hpp"
+#include "blocking_queue.hpp"
+#include <cinttypes>
+#include <new>
+
+
+/**
+ * Worker task executing the callbacks of deferred timers
+ */
+struct Timer::Worker final : Thread<TIMER_WORKER_STACK_SIZE>
+{
+    // the worker is created on first use while the scheduler is running,
+    // so its task must not start before the queue was constructed
+    Worker() : Thread({.name = "timer worker", .priority = 1, .autostart = false}) { startTask(); }
+
+    ESPQueue<TIMER_WORKER_QUEUE_LENGTH, Slot*> queue{};
+
+protected:
+    void run() override
+    {
+        Slot* slot;
+        queue.take(slot);
+        slot->queued.clear();
+        execute(*slot);
+        // the instance might have been destroyed while the slot was queued
+        release(*slot);
+    }
+};
+
+/**
+ * Slot of a timer instance, which is allocated separately, so it can outlive the instance
+ * until the timer service processed the deletion of its timer
+ */
+struct Timer::OwnedSlot final : Slot
+{
+    StaticSemaphore_t lock_buffer{};
+};
+
+// defined out of class, as the slot's default member initializers are not usable inside the class definition
+std::array<Timer::Slot, TIMER_DETACHED_POOL_SIZE> Timer::s_pool{};
+std::atomic<uint32_t> Timer::s_skipped{0};
+
+static constexpr TickType_t to_ticks(uint16_t seconds)
+{
+    return pdMS_TO_TICKS(static_cast<uint32_t>(seconds) * 1000);
+}
+
+// the timer service can't wait for itself to process its command queue, so it must only queue commands without waiting
+static TickType_t command_timeout()
+{
+    return xTaskGetCurrentTaskHandle() == xTimerGetTimerDaemonTaskHandle() ? 0 : portMAX_DELAY;
+}
+
 
 bool Timer::detached(uint16_t seconds, const callback_t& callback)
 {
-    auto timer = xTimerCreate(nullptr, pdMS_TO_TICKS(seconds * 1000), pdFALSE, nullptr, s_callback);
-    s_callbacks.try_emplace(timer, callback);
-    if (timer)
+    auto period = to_ticks(seconds);
+
+    for (auto& slot : s_pool)
     {
-        return xTimerStart(timer, 0) == pdTRUE;
+        if (slot.used.test_and_set(std::memory_order_acquire))
+            continue;
+
+        slot.callback = callback;
+        if (!slot.timer)
+            slot.timer = xTimerCreateStatic(nullptr, period, pdFALSE, &slot, s_callback, &slot.buffer);
+
+        // changing the period of a dormant timer also starts it
+        if (slot.timer && xTimerChangePeriod(slot.timer, period, 0) == pdPASS)
+            return true;
+
+        slot.callback = nullptr;
+        slot.used.clear(std::memory_order_release);
+        return false;
     }
+
+    // the pool is exhausted, so fall back to a timer deleting itself after execution
+    auto* slot = new(std::nothrow) Slot{.callback = callback, .kind = Slot::heap};
+    if (!slot)
+        return false;
+
+    slot->timer = xTimerCreate(nullptr, period, pdFALSE, slot, s_callback);
+    if (slot->timer && xTimerStart(slot->timer, 0) == pdPASS)
+        return true;
+
+    if (slot->timer)
+        xTimerDelete(slot->timer, 0);
+    delete slot;
     return false;
 }
 
+uint32_t Timer::skipped()
+{
+    return s_skipped;
+}
+
 Timer::~Timer()
 {
-    if (m_timer)
+    if (!m_slot)
+        return;
+
+    // waits for an execution on another task; inside its own callback, the recursive lock is taken immediately
+    xSemaphoreTakeRecursive(m_slot->lock, portMAX_DELAY);
+    m_slot->alive = false;
+    xSemaphoreGiveRecursive(m_slot->lock);
+
+    // the timer service processes its commands in order, so the slot holding the timer buffer
+    // is released after the deletion was processed
+    auto timeout = command_timeout();
+    if (xTimerDelete(m_slot->timer, timeout) != pdPASS || xTimerPendFunctionCall(s_release, m_slot, 0, timeout) != pdPASS)
     {
-        xTimerDelete(m_timer, 0);
+        // the slot is not alive anymore, so a timer that keeps running does nothing
+        LOG_W("Timer service queue is full, leaking the timer %s", m_name ? m_name : "<unnamed>");
     }
 }
 
+const Timer::Stats& Timer::stats() const
+{
+    static const Stats none{};
+    return m_slot ? m_slot->stats : none;
+}
+
 bool Timer::once(uint16_t seconds, const callback_t& callback, bool start)
 {
     return create(seconds, callback, pdFALSE, start);
@@ -32,65 +135,196 @@ bool Timer::always(uint16_t seconds, const callback_t& callback, bool start)
 
 void Timer::stop() const
 {
-    if (m_timer)
+    if (m_slot)
     {
-        xTimerStop(m_timer, 0);
+        xTimerStop(m_slot->timer, 0);
     }
 }
 
 void Timer::start() const
 {
-    if (m_timer)
+    if (m_slot)
     {
-        xTimerStart(m_timer, 0);
+        xTimerStart(m_slot->timer, 0);
     }
 }
 
 void Timer::reset() const
 {
-    if (m_timer)
+    if (m_slot)
     {
-        xTimerReset(m_timer, 0);
+        xTimerReset(m_slot->timer, 0);
     }
 }
 
 void Timer::changePeriod(uint16_t seconds) const
 {
-    if (m_timer)
+    if (m_slot)
     {
-        xTimerChangePeriod(m_timer, pdMS_TO_TICKS(seconds * 1000), 0);
+        xTimerChangePeriod(m_slot->timer, to_ticks(seconds), 0);
     }
 }
 
 void Timer::setReload(BaseType_t reload) const
 {
-    if (m_timer)
+    if (m_slot)
+    {
+        vTimerSetReloadMode(m_slot->timer, reload);
+    }
+}
+
+void Timer::setDeferred(bool deferred)
+{
+    m_deferred = deferred;
+    if (m_slot)
+        m_slot->deferred = deferred;
+    if (deferred)
     {
-        vTimerSetReloadMode(m_timer, reload);
+        // create the worker before the first deferred execution
+        worker();
     }
 }
 
+Timer::Worker& Timer::worker()
+{
+    // function-local to only create the worker task if any timer is deferred
+    static Worker worker{};
+    return worker;
+}
+
+void Timer::s_release(void* slot, uint32_t)
+{
+    release(*static_cast<OwnedSlot*>(slot));
+}
+
+void Timer::release(Slot& slot)
+{
+    if (--slot.references > 0)
+        return;
+
+    auto* owned = static_cast<OwnedSlot*>(&slot);
+    vSemaphoreDelete(owned->lock);
+    delete owned;
+}
+
 void Timer::s_callback(TimerHandle_t timer)
 {
-    s_callbacks.at(timer)();
-    if (static_cast<bool>(pvTimerGetTimerID(timer)))
+    auto* slot = static_cast<Slot*>(pvTimerGetTimerID(timer));
+
+    if (slot->kind == Slot::owned)
+    {
+        if (!slot->deferred)
+        {
+            execute(*slot);
+        }
+        // a repeating timer might fire again before its last execution was taken from the queue
+        else if (!slot->queued.test_and_set())
+        {
+            // the instance's reference is only released on this task, so the slot can't be freed in between
+            ++slot->references;
+            if (!worker().queue.offer(slot))
+            {
+                --slot->references;
+                slot->queued.clear();
+                ++slot->stats.skipped;
+                // a full queue usually persists for several firings, so further skips are only counted
+                if (s_skipped++ == 0)
+                {
+                    LOG_W("Timer worker queue is full, skipping execution of timer %s", slot->name ? slot->name : "<unnamed>");
+                }
+            }
+        }
+        return;
+    }
+
+    execute(*slot);
+    // release any captured state before the slot can be reused
+    slot->callback = nullptr;
+
+    if (slot->kind == Slot::heap)
     {
         xTimerDelete(timer, 0);
-        s_callbacks.erase(timer);
+        delete slot;
+    }
+    else
+    {
+        slot->used.clear(std::memory_order_release);
+    }
+}
+
+void Timer::execute(Slot& slot)
+{
+    auto start = esp_timer_get_time();
+
+    if (slot.lock)
+    {
+        xSemaphoreTakeRecursive(slot.lock, portMAX_DELAY);
+        if (slot.alive && slot.callback)
+            slot.callback();
+        xSemaphoreGiveRecursive(slot.lock);
+    }
+    else
+    {
+        slot.callback();
+    }
+
+    auto runtime = static_cast<uint32_t>(esp_timer_get_time() - start);
+    ++slot.stats.executions;
+    slot.stats.max_runtime_us = _max(slot.stats.max_runtime_us, runtime);
+
+    if (!slot.deferred && runtime > TIMER_CALLBACK_BUDGET_US)
+    {
+        ++slot.stats.overruns;
+        LOG_W("Timer %s callback blocked the timer service for %" PRIu32 " us (budget: %u us), consider deferring it",
+              slot.name ? slot.name : "<unnamed>", runtime, TIMER_CALLBACK_BUDGET_US);
     }
 }
 
 bool Timer::create(uint16_t seconds, const callback_t& callback, BaseType_t reload, bool start)
 {
-    if (m_timer)
+    auto period = to_ticks(seconds);
+    auto timeout = command_timeout();
+
+    if (!m_slot)
     {
-        xTimerDelete(m_timer, 0);
+        auto* slot = new(std::nothrow) OwnedSlot{};
+        if (!slot)
+            return false;
+
+        slot->name = m_name;
+        slot->kind = Slot::owned;
+        slot->deferred = m_deferred;
+        slot->callback = callback;
+        slot->lock = xSemaphoreCreateRecursiveMutexStatic(&slot->lock_buffer);
+        slot->timer = xTimerCreateStatic(nullptr, period, reload, slot, s_callback, &slot->buffer);
+        if (!slot->timer)
+        {
+            vSemaphoreDelete(slot->lock);
+            delete slot;
+            return false;
+        }
+
+        m_slot = slot;
+        if (start)
+        {
+            xTimerStart(m_slot->timer, timeout);
+        }
+        return true;
     }
-    m_timer = xTimerCreate(nullptr, pdMS_TO_TICKS(seconds * 1000), reload, nullptr, s_callback);
-    s_callbacks.try_emplace(m_timer, callback);
-    if (start && m_timer)
+
+    // reuse the existing timer instead of re-creating it, as the timer service might still reference it
+    xTimerStop(m_slot->timer, timeout);
+
+    xSemaphoreTakeRecursive(m_slot->lock, portMAX_DELAY);
+    m_slot->callback = callback;
+    xSemaphoreGiveRecursive(m_slot->lock);
+
+    vTimerSetReloadMode(m_slot->timer, reload);
+    // changing the period of a dormant timer also starts it
+    xTimerChangePeriod(m_slot->timer, period, timeout);
+    if (!start)
     {
-        xTimerStart(m_timer, 0);
+        xTimerStop(m_slot->timer, timeout);
     }
-    return m_timer;
+    return true;
 }
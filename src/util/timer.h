@@ -2,18 +2,61 @@
 #define TIMER_H
 
 #include <Arduino.h>
-#include <unordered_map>
+#include <array>
+#include <atomic>
 #include <functional>
 
+#ifndef TIMER_DETACHED_POOL_SIZE
+#define TIMER_DETACHED_POOL_SIZE 8
+#endif
+
+#ifndef TIMER_CALLBACK_BUDGET_US
+#define TIMER_CALLBACK_BUDGET_US 5000
+#endif
+
+#ifndef TIMER_WORKER_STACK_SIZE
+#define TIMER_WORKER_STACK_SIZE 4096
+#endif
+
+#ifndef TIMER_WORKER_QUEUE_LENGTH
+#define TIMER_WORKER_QUEUE_LENGTH 8
+#endif
+
 
 /**
  * Timer class for calling an action after a given period, either once or repeating
+ *
+ * The callback is stored alongside the FreeRTOS timer, which carries a pointer to it as its timer ID,
+ * so firing a timer needs neither a lookup nor an allocation;
+ * detached timers are taken from a fixed pool and only fall back to the heap if the pool is exhausted.
+ * The timer of an instance is allocated once it is first assigned a callback and released by the timer service
+ * after processing its deletion, so an instance may be destroyed from any task, including inside a callback
+ *
+ * Callbacks run on the FreeRTOS timer service task and thus block all other timers while executing;
+ * each execution is measured and callbacks exceeding TIMER_CALLBACK_BUDGET_US are reported.
+ * Timers with long-running callbacks (e.g., doing I2C or flash operations) should be set to deferred,
+ * which runs their callbacks on a separate worker task instead
  */
 class Timer
 {
     using callback_t = std::function<void()>;
 
 public:
+    /**
+     * Callback execution statistics of a timer
+     */
+    struct Stats
+    {
+        //! The number of callback executions
+        uint32_t executions = 0;
+        //! The number of executions on the timer service task exceeding the callback budget
+        uint32_t overruns = 0;
+        //! The longest callback execution time in µs
+        uint32_t max_runtime_us = 0;
+        //! The number of deferred executions skipped as the worker queue was full
+        uint32_t skipped = 0;
+    };
+
     /**
      * Creates a non-repeating detached timer instance that will delete itself after execution
      * @param seconds The seconds after which the timed action should occur
@@ -22,7 +65,20 @@ public:
     static bool detached(uint16_t seconds, const callback_t& callback);
 
     /**
-     * Deletes the timer
+     * Get the number of deferred executions skipped on any timer as the worker queue was full;
+     * only the first skip is logged
+     */
+    static uint32_t skipped();
+
+    /**
+     * Creates a new timer
+     * @param name The name of the timer, used for reporting callback budget overruns
+     */
+    explicit Timer(const char* name = nullptr) : m_name(name) {}
+
+    /**
+     * Deletes the timer, waiting for a callback execution running on another task to complete;
+     * callback executions pending afterward are skipped
      */
     ~Timer();
 
@@ -71,11 +127,64 @@ public:
      */
     void setReload(BaseType_t reload) const;
 
-private:
-    inline static std::unordered_map<TimerHandle_t, callback_t> s_callbacks{};
-    TimerHandle_t m_timer{};
+    /**
+     * Set whether the callback should be run on the timer worker task instead of the timer service task
+     * @param deferred Whether the callback execution should be deferred to the worker task
+     */
+    void setDeferred(bool deferred);
+
+    /**
+     * Get the callback execution statistics of this timer
+     */
+    [[nodiscard]] const Stats& stats() const;
+
+    // delete copy constructor and assignment operator as the timer ID points into the instance
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
 
+private:
+    /**
+     * Storage of a timer's callback and its static FreeRTOS timer buffer
+     */
+    struct Slot
+    {
+        enum Kind : uint8_t { owned, pooled, heap };
+
+        const char* name = nullptr;
+        callback_t callback{};
+        TimerHandle_t timer{};
+        StaticTimer_t buffer{};
+        Kind kind = pooled;
+        // serializes exchanging the callback of an owned slot with the timer service executing it
+        SemaphoreHandle_t lock{};
+        // cleared when the owning instance is destroyed, skipping any pending execution
+        std::atomic<bool> alive{true};
+        // marks a pooled slot as being in use
+        std::atomic_flag used = ATOMIC_FLAG_INIT;
+        // whether the callback is executed by the worker task; changed by the instance while the timer service reads it
+        std::atomic<bool> deferred{false};
+        // marks a deferred slot as being queued for execution by the worker task
+        std::atomic_flag queued = ATOMIC_FLAG_INIT;
+        // the references to an owned slot, held by its instance until its timer was deleted and by the worker queue
+        std::atomic<uint8_t> references{1};
+        Stats stats{};
+    };
+
+    struct OwnedSlot;
+    struct Worker;
+
+    static std::array<Slot, TIMER_DETACHED_POOL_SIZE> s_pool;
+    static std::atomic<uint32_t> s_skipped;
+    const char* m_name;
+    bool m_deferred{false};
+    OwnedSlot* m_slot{};
+
+    static Worker& worker();
     static void s_callback(TimerHandle_t timer);
+    static void s_release(void* slot, uint32_t);
+    static void release(Slot& slot);
+    static void execute(Slot& slot);
     bool create(uint16_t seconds, const callback_t& callback, BaseType_t reload, bool start);
 };
 